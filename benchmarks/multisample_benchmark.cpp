@@ -0,0 +1,132 @@
+/* multisample_benchmark.cpp
+ *
+ * Compares the cost of anti-aliasing a scene with multisampling (SetMultisampling) against
+ * plain supersampling, where the scene is drawn at twice the width and height and then
+ * averaged down 2x2 pixels at a time. Both give 4 samples per pixel; multisampling also has
+ * an 8x mode.
+ *
+ * Build and run with `make benchmark` (draws offscreen, so no window is needed).
+ *
+ * @author Alex Wills
+ * @date May 24, 2023
+ */
+
+#include "../lib/graphics.h"
+#include <chrono>
+#include <cstdio>
+
+static const int canvas_size = 700;
+static const int frame_count = 60;
+
+/*
+ * Fills a scene with a field of cubes and some long, thin beams, which alias badly without anti-aliasing.
+ */
+static void BuildScene(Scene* scene, Model* cube, std::vector<ModelInstance>& instances)
+{
+	instances.reserve(160);
+	for (int i = 0; i < 100; ++i)
+	{
+		Transform transform(1, 1 + (i % 3) * 0.3f, 1, i * 0.3f, i * 0.7f, i * 0.1f, (i % 10) * 3 - 15, (i / 10) * 2 - 8, 8 + (i % 7) * 4);
+		instances.push_back(ModelInstance(cube, transform));
+	}
+	for (int i = 0; i < 60; ++i)
+	{
+		Transform transform(6, 0.03f, 0.03f, 0, 0.1f * i, 0.05f * i, (i % 6) * 4 - 10, (i / 6) * 1.5f - 7, 12 + (i % 4) * 3);
+		instances.push_back(ModelInstance(cube, transform));
+	}
+	for (ModelInstance& instance : instances)
+	{
+		scene->AddModelInstance(instance);
+	}
+}
+
+/*
+ * Draws the scene for frame_count frames with the camera slowly turning.
+ *
+ * @param downsample - if not null, the frame is averaged 2x2 into this buffer after every frame
+ * @return the average time per frame in milliseconds
+ */
+static double DrawFrames(GraphicsManager& graphics, Scene* scene, std::vector<uint32_t>* downsample)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int frame = 0; frame < frame_count; ++frame)
+	{
+		graphics.GetMainCamera()->GetTransform()->rotation[1] = frame * 0.02f;
+		graphics.ChangeBrushColor(BLACK);
+		graphics.ClearScreen();
+		scene->RenderScene();
+		graphics.RefreshScreen();
+
+		if (downsample != nullptr)
+		{
+			// Box filter: every output pixel is the average of a 2x2 block of the large frame
+			const FrameBuffer* frame_buffer = graphics.GetFrameBuffer();
+			for (int y = 0; y < canvas_size; ++y)
+			{
+				const uint32_t* upper = frame_buffer->GetLinearRow(2 * y);
+				const uint32_t* lower = frame_buffer->GetLinearRow(2 * y + 1);
+				for (int x = 0; x < canvas_size; ++x)
+				{
+					uint32_t pixel = 0;
+					for (int shift = 0; shift < 32; shift += 8)
+					{
+						uint32_t sum = ((upper[2 * x] >> shift) & 0xFF) + ((upper[2 * x + 1] >> shift) & 0xFF)
+							+ ((lower[2 * x] >> shift) & 0xFF) + ((lower[2 * x + 1] >> shift) & 0xFF);
+						pixel |= ((sum + 2) / 4) << shift;
+					}
+					(*downsample)[y * canvas_size + x] = pixel;
+				}
+			}
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / frame_count;
+}
+
+/*
+ * Sets up a graphics manager and scene, draws them, and prints the time per frame.
+ *
+ * @param label - what to print for this run
+ * @param scale - 1 for the normal canvas size, 2 to supersample
+ * @param samples - the sample count to pass to SetMultisampling
+ */
+static void RunBenchmark(const char* label, int scale, int samples)
+{
+	std::vector<Point3D> vertices = {{1, 1, 1}, {-1, 1, 1}, {-1, -1, 1}, {1, -1, 1}, {1, 1, -1}, {-1, 1, -1}, {-1, -1, -1}, {1, -1, -1}};
+	Color light = {171, 244, 255}, pink = {202, 121, 237}, blue = {90, 166, 232};
+	std::vector<Triangle> triangles = {{0, 1, 2, light}, {0, 2, 3, light}, {4, 0, 3, pink}, {4, 3, 7, pink},
+		{5, 4, 7, light}, {5, 7, 6, light}, {1, 5, 6, pink}, {1, 6, 2, pink},
+		{4, 5, 1, blue}, {4, 1, 0, blue}, {2, 6, 7, blue}, {2, 7, 3, blue}};
+	Model cube = {vertices, triangles};
+
+	GraphicsManager graphics;
+	graphics.SetMultisampling(samples);
+	graphics.OpenOffscreen(canvas_size * scale, canvas_size * scale);
+	graphics.GetMainCamera()->SetViewportDistance(0.2);
+
+	Scene* scene = graphics.CreateScene();
+	std::vector<ModelInstance> instances;
+	BuildScene(scene, &cube, instances);
+
+	std::vector<uint32_t> downsample;
+	if (scale > 1)
+	{
+		downsample.resize(canvas_size * canvas_size);
+	}
+
+	DrawFrames(graphics, scene, (scale > 1) ? &downsample : nullptr);	// Warm up
+	double milliseconds = DrawFrames(graphics, scene, (scale > 1) ? &downsample : nullptr);
+	std::printf("%-28s %8.3f ms/frame\n", label, milliseconds);
+
+	graphics.CloseWindow();
+}
+
+int main()
+{
+	std::printf("%d x %d canvas, %d frames\n", canvas_size, canvas_size, frame_count);
+	RunBenchmark("No anti-aliasing", 1, 1);
+	RunBenchmark("Multisampling 4x", 1, 4);
+	RunBenchmark("Multisampling 8x", 1, 8);
+	RunBenchmark("Supersampling 4x (2x2)", 2, 1);
+	return 0;
+}
@@ -0,0 +1,93 @@
+/* vertex_transform_benchmark.cpp
+ *
+ * Measures how many vertices per second can be moved by one TransformMatrix, with the batch
+ * kernel (VertexStream::TransformFrom) and with one TransformMatrix * HomCoordinates per point.
+ * Small meshes stay in the cache and show the cost of the math; large ones show how close the
+ * kernel gets to memory bandwidth.
+ *
+ * Build and run with `make benchmark`.
+ *
+ * @author Alex Wills
+ * @date May 25, 2023
+ */
+
+#include "../lib/graphics.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+/*
+ * Returns the fastest time of a number of runs of a function, in seconds.
+ */
+template <typename Function>
+static double FastestRun(int runs, Function function)
+{
+	double fastest = 1e30;
+	for (int run = 0; run < runs; ++run)
+	{
+		auto start = std::chrono::steady_clock::now();
+		function();
+		auto end = std::chrono::steady_clock::now();
+		fastest = std::min(fastest, std::chrono::duration<double>(end - start).count());
+	}
+	return fastest;
+}
+
+/*
+ * Times both ways of transforming a mesh of vertex_count vertices and prints millions of vertices per second.
+ */
+static void RunBenchmark(int vertex_count)
+{
+	// A made up mesh, spread out like a real one
+	VertexStream stream;
+	std::vector<HomCoordinates> points(vertex_count);
+	stream.Resize(vertex_count);
+	for (int i = 0; i < vertex_count; ++i)
+	{
+		Point3D point = {float(i % 97) - 48, float(i % 89) - 44, float(i % 83) + 5};
+		stream.Set(i, point);
+		points[i] = HomCoordinates(point);
+	}
+	TransformMatrix matrix = Transform(1, 2, 1, 0.3f, 0.2f, 0.1f, 1, 2, 30);
+
+	// Model space to world space, as GenerateWorldspacePoints does
+	int runs = std::max(5, 20000000 / vertex_count);
+	VertexStream output;
+	std::vector<HomCoordinates> transformed(vertex_count);
+	double batch = FastestRun(runs, [&]() { output.TransformFrom(stream, matrix); });
+	double per_point = FastestRun(runs, [&]()
+	{
+		for (int i = 0; i < vertex_count; ++i)
+		{
+			transformed[i] = matrix * points[i];
+		}
+	});
+
+	// Compare every point, which also uses the results so the compiler cannot skip the work.
+	// Built with -ffp-contract=off (see the makefile), both ways give exactly the same points.
+	float largest_difference = 0;
+	for (int i = 0; i < vertex_count; ++i)
+	{
+		largest_difference = std::max(largest_difference, std::fabs(output.X()[i] - transformed[i][0]));
+		largest_difference = std::max(largest_difference, std::fabs(output.Y()[i] - transformed[i][1]));
+		largest_difference = std::max(largest_difference, std::fabs(output.Z()[i] - transformed[i][2]));
+	}
+
+	std::printf("%9d vertices   batch %9.1f M vertices/s   per point %7.1f M vertices/s   (%.1fx)  largest difference %g\n",
+		vertex_count, vertex_count / batch / 1e6, vertex_count / per_point / 1e6, per_point / batch, largest_difference);
+}
+
+int main()
+{
+#if defined(__AVX2__)
+	std::printf("Batch kernel: AVX2 (8 vertices at a time)\n");
+#elif defined(__SSE2__)
+	std::printf("Batch kernel: SSE2 (4 vertices at a time)\n");
+#else
+	std::printf("Batch kernel: scalar\n");
+#endif
+	RunBenchmark(1000);
+	RunBenchmark(100000);
+	RunBenchmark(1000000);
+	return 0;
+}
@@ -7,6 +7,7 @@
  * 1) Include this file in a program
  * 2) Instantiate a GraphicsManager object
  * 3) Call OpenWindow(int width, int height)
+ *      (or OpenOffscreen(int width, int height) to render into memory without a window)
  * 4) > insert all of your wonderful graphics program here <
  * 5) Call CloseWindow() to finish
  *
@@ -21,8 +22,15 @@
 #include <SDL2/SDL.h>
 #include "graphics_math.h"
 #include "graphics_utility.h"
+#include "graphics_vertex_stream.h"
 #include "graphics_scene.h"
+#include "graphics_framebuffer.h"
 #include "graphics_hsr.h"
+#include "graphics_capture.h"
+#include "graphics_raster.h"
+#include "graphics_tiles.h"
+#include "graphics_scratch.h"
+#include "graphics_multisample.h"
 // #include "graphics_scene_plus.h"
 
 // Color constants
@@ -51,6 +59,19 @@ public:
 	{
 		std::cout << "~ Creating Graphics Manager" << std::endl;
 		drawCount = 0;
+		renderer = nullptr;
+		window = nullptr;
+		screen_texture = nullptr;
+		is_offscreen = false;
+		frame_capture = nullptr;
+		is_batching = false;
+		canvas_width = 0;
+		canvas_height = 0;
+		depth_format = DepthFormat::FLOAT32;
+		buffer_layout = BufferLayout::LINEAR;
+		shading_mode = ShadingMode::FORWARD;
+		sample_count = 1;
+		use_simd_kernels = true;
 	}
 
 
@@ -58,6 +79,8 @@ private:
 	// Objects from SDL for handling graphics
 	SDL_Renderer* renderer;
 	SDL_Window* window;
+	SDL_Texture* screen_texture;	// Streaming texture that the frame buffer is uploaded to every frame
+	bool is_offscreen;		// True if rendering into memory only (no window, SDL is never initialized)
 	// TODO: SINCE WHEN ARE EVENTS GRAPHICS?
 	SDL_Event event_handler;
 
@@ -69,6 +92,26 @@ private:
 	Scene current_scene;	// The current scene
 
 	DepthBuffer depth_buffer;	// Used to store information about the depth of current pixels
+	DepthFormat depth_format;	// How the depth buffer stores each depth value
+	BufferLayout buffer_layout;	// How the frame buffer and depth buffer arrange their pixels
+	bool use_simd_kernels;		// False to draw depth tested triangles one pixel at a time (for checking the SIMD kernels)
+
+	FrameBuffer frame_buffer;	// CPU-side color buffer that every draw call writes into
+	uint32_t brush_color;		// Packed color that pixels are drawn with
+
+	ShadingMode shading_mode;		// How scenes shade their triangles
+	FrameBuffer visibility_buffer;	// ID of the triangle visible at each pixel (0 for none), only allocated for DEFERRED shading
+
+	int sample_count;				// Samples per pixel for depth tested triangles (1 is no multisampling)
+	SampleBuffer sample_buffer;		// Per-sample colors and depths, averaged into the frame buffer by RefreshScreen()
+
+	FrameCapture* frame_capture;	// If not null, every refreshed frame is sent here to be recorded
+
+	RenderThreadPool render_threads;	// Threads that rasterize screen tiles in parallel
+	TileBinner tile_binner;		// Triangles waiting to be drawn, sorted into screen tiles
+	bool is_batching;			// True between BeginTriangleBatch() and EndTriangleBatch()
+
+	ScratchArena scratch_arena;	// Temporary memory for drawing on the calling thread (projected points)
 
 
 // Functions to be implemented in graphics_backend.cpp
@@ -80,11 +123,47 @@ public:
 	 * @param height - the height of the window in pixels
 	 */
 	void OpenWindow(int width, int height);
+
+	/*
+	 * Initializes the canvas, camera, and depth buffer exactly like OpenWindow, but renders
+	 * into memory only. No window is created and SDL is never initialized, so this works
+	 * without a display. Read the results back with GetFrameBuffer().
+	 *
+	 * @param width - the width of the canvas in pixels
+	 * @param height - the height of the canvas in pixels
+	 */
+	void OpenOffscreen(int width, int height);
 	
 	/*
-	 * Closes the window and deactivates SDL.
+	 * Closes the window and deactivates SDL (does nothing to SDL when rendering offscreen).
 	 */
 	void CloseWindow();
+
+	/*
+	 * Returns true if this GraphicsManager renders into memory without a window.
+	 */
+	bool IsOffscreen()
+	{
+		return this->is_offscreen;
+	}
+
+	/*
+	 * Changes how the frame buffer and depth buffer arrange their pixels in memory.
+	 * BufferLayout::BLOCKED keeps each 8x8 block of pixels together, so that the depth tested
+	 * triangle kernel touches one or two cache lines per block instead of one per row.
+	 * The image is turned back into rows when the screen is refreshed.
+	 * Recreates (and clears) both buffers if the canvas is already open.
+	 */
+	void SetBufferLayout(BufferLayout layout);
+
+	/*
+	 * Returns a pointer to the color buffer that every draw call writes into (read only access).
+	 * Read the presented image with GetLinearRow(), which is up to date after RefreshScreen().
+	 */
+	const FrameBuffer* GetFrameBuffer()
+	{
+		return &(this->frame_buffer);
+	}
 	
 	/*
 	 * Keeps the window open by blocking the program.
@@ -122,9 +201,23 @@ public:
 	
 	/*
 	 * Updates the screen to reflect any changes made by placing pixels.
+	 * The frame buffer is uploaded to the window in one texture update.
 	 */
 	void RefreshScreen();
 
+	/*
+	 * Starts sending every frame passed to RefreshScreen() to a capture sink.
+	 * The capture is opened with the dimensions of the canvas.
+	 *
+	 * @param capture - the capture to record frames with (not owned by the GraphicsManager)
+	 */
+	void StartCapture(FrameCapture* capture);
+
+	/*
+	 * Stops recording frames and closes the current capture, if there is one.
+	 */
+	void StopCapture();
+
 	/*
 	 * Clear the screen.
 	 */
@@ -176,6 +269,86 @@ public:
 	 */
 	void DrawGradientTriangle(Point2D p0, Point2D p1, Point2D p2, Color color, float h1, float h2, float h3);
 
+private:
+	/*
+	 * Converts a y coordinate (0 is the center, positive is up) to a row in the frame buffer
+	 * (0 is the top of the screen).
+	 */
+	inline int ScreenRow(int y)
+	{
+		return this->max_screen_y - y;
+	}
+
+	/*
+	 * Converts an x coordinate (0 is the center) to a column in the frame buffer
+	 * (0 is the left side of the screen).
+	 */
+	inline int ScreenColumn(int x)
+	{
+		return this->max_screen_x + x;
+	}
+
+	/*
+	 * Sets up the canvas dimensions, camera, depth buffer, and frame buffer.
+	 * Shared by OpenWindow and OpenOffscreen.
+	 */
+	void InitializeCanvas(int width, int height);
+
+// Edge function rasterizer, implemented in graphics_rasterizer.cpp
+private:
+	/*
+	 * Returns the whole canvas as a rectangle in buffer space.
+	 */
+	ScreenRect GetScreenRect();
+
+	/*
+	 * Computes the edge functions and bounding box (clipped to the screen) of a triangle.
+	 *
+	 * @param margin - pixels to grow the bounding box by on every side (1 when sampling away from pixel centers)
+	 * @return false if the triangle has no area or is entirely off the screen
+	 */
+	bool SetupTriangle(SubPixelPoint p0, SubPixelPoint p1, SubPixelPoint p2, TriangleSetup& setup, int margin = 0);
+
+	/*
+	 * Computes the plane equation of a value given at each vertex of a set up triangle.
+	 */
+	void SetupAttributePlane(TriangleSetup& setup, float v0, float v1, float v2);
+
+	/*
+	 * Fills in the pixels of a set up triangle that are inside a rectangle of the screen.
+	 */
+	void RasterizeTriangle(const TriangleSetup& setup, ScreenRect rect);
+
+	/*
+	 * SIMD kernel for depth tested triangles (SSE2, or AVX2 when enabled at compile time).
+	 * Writes packed_color into target (the frame buffer, or the visibility buffer).
+	 *
+	 * @return false if the kernel could not be used and nothing was drawn
+	 */
+	bool RasterizeDepthBlocks(const TriangleSetup& setup, FrameBuffer& target, int min_x, int max_x, int min_y, int max_y);
+
+	/*
+	 * One pixel at a time fallback for depth tested triangles.
+	 */
+	void RasterizeDepthPixels(const TriangleSetup& setup, FrameBuffer& target, int min_x, int max_x, int min_y, int max_y);
+
+	/*
+	 * Depth tested triangle kernel for multisampling: tests every sample of a pixel and writes
+	 * the covered samples that pass into the sample buffer.
+	 */
+	void RasterizeMultisampled(const TriangleSetup& setup, int min_x, int max_x, int min_y, int max_y);
+
+	/*
+	 * Averages the samples of every pixel that a multisampled triangle touched into the frame buffer.
+	 */
+	void ResolveSamples();
+
+	/*
+	 * Sets up a depth tested triangle (DEPTH or VISIBILITY) and draws it, or adds it to the current batch.
+	 */
+	void SubmitDepthTriangle(SubPixelPoint p0, SubPixelPoint p1, SubPixelPoint p2, RasterMode mode, uint32_t value,
+		float depth0, float depth1, float depth2);
+
 // 3D Drawing
 public:
 	/***************************************
@@ -224,11 +397,104 @@ public:
 public:
 	inline void ClearDepthBuffer()
 	{
+		// Fixed point depth formats spread their precision from the near clipping plane to infinity
+		this->depth_buffer.SetDepthRange(1 / this->main_camera.GetViewportDistance());
 		this->depth_buffer.ClearBuffer();
+		this->sample_buffer.Clear();
+	}
+
+	/*
+	 * Turns on multisample anti-aliasing for depth tested triangles with 4 or 8 samples per
+	 * pixel (1 turns it off). Each pixel is shaded once per triangle, depth is tested and stored
+	 * for every sample, and the samples are averaged when the screen is refreshed.
+	 * Other drawing functions are not multisampled, and multisampled triangles are drawn over
+	 * them where they overlap. DEFERRED shading is not multisampled.
+	 */
+	void SetMultisampling(int samples);
+
+	/*
+	 * Changes how the depth buffer stores depth values. The 16-bit format halves the memory
+	 * traffic of depth testing, at the cost of precision for far away surfaces.
+	 * Recreates (and clears) the depth buffer if the canvas is already open.
+	 */
+	void SetDepthFormat(DepthFormat format);
+
+	/*
+	 * Chooses whether depth tested triangles are drawn several pixels at a time with SIMD
+	 * instructions (the default, when the compiler supports them) or one pixel at a time.
+	 * Both give the same image; turning SIMD off is only useful for checking that they do.
+	 */
+	void SetSimdRasterization(bool enabled)
+	{
+		this->use_simd_kernels = enabled;
 	}
 	
 	void DrawDepthTriangle(Point2D p0, Point2D p1, Point2D p2, Color color, 
 		float depth0, float depth1, float depth2);
+	void DrawDepthTriangle(SubPixelPoint p0, SubPixelPoint p1, SubPixelPoint p2, Color color,
+		float depth0, float depth1, float depth2);
+
+	/*
+	 * Chooses how scenes shade their triangles. With ShadingMode::DEFERRED, a scene only
+	 * rasterizes depth and triangle IDs into a visibility buffer, then works out the color of
+	 * each visible pixel once, so the cost of shading does not grow with overdraw.
+	 */
+	void SetShadingMode(ShadingMode mode);
+
+	ShadingMode GetShadingMode()
+	{
+		return this->shading_mode;
+	}
+
+	/*
+	 * Draws a depth tested triangle into the visibility buffer: pixels that are closer than the
+	 * depth buffer get the triangle's ID instead of a color. Needs ShadingMode::DEFERRED.
+	 *
+	 * @param id - a number identifying the triangle (0 means "no triangle")
+	 */
+	void DrawVisibilityTriangle(SubPixelPoint p0, SubPixelPoint p1, SubPixelPoint p2, uint32_t id,
+		float depth0, float depth1, float depth2);
+
+	/*
+	 * Sets every pixel of the visibility buffer to 0 (no triangle).
+	 */
+	void ClearVisibilityBuffer();
+
+	/*
+	 * Colors the frame buffer from the visibility buffer, calling shade(id) to get the packed
+	 * color for each visible triangle ID. Pixels with no triangle keep their color. The screen
+	 * is split into bands of rows across the render threads, so shade must be safe to call
+	 * from several threads at once.
+	 */
+	void ResolveVisibilityBuffer(const std::function<uint32_t(uint32_t)>& shade);
+
+	/*
+	 * Returns the scratch memory of the thread that calls the drawing functions (the render
+	 * threads do not allocate). Take a Mark() before allocating and Rewind() to it when done.
+	 */
+	ScratchArena& GetScratchArena()
+	{
+		return this->scratch_arena;
+	}
+
+	/*
+	 * Sets how many threads (including the calling thread) rasterize batches of triangles.
+	 * With 1 thread (the default), every triangle is drawn as soon as it is submitted.
+	 */
+	void SetRenderThreads(int thread_count);
+
+	/*
+	 * Starts a batch of depth tested triangles. Until EndTriangleBatch() is called,
+	 * DrawDepthTriangle() only sets up each triangle and sorts it into screen tiles.
+	 * Other drawing functions still draw right away, so avoid mixing them into a batch.
+	 */
+	void BeginTriangleBatch();
+
+	/*
+	 * Draws every triangle in the current batch, with the screen tiles split across the
+	 * render threads. The result is identical to drawing the triangles one at a time.
+	 */
+	void EndTriangleBatch();
 
 // Things added for fun
 public:
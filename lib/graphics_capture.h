@@ -0,0 +1,158 @@
+/* graphics_capture.h
+ *
+ * Records presented frames to disk, either as a numbered sequence of PPM images
+ * or as a single raw Y4M (YUV4MPEG2) video stream.
+ *
+ * Frames are copied into a small pool of buffers and written by a background thread,
+ * so capturing does not stall the render loop. When every buffer is waiting to be
+ * written, new frames are either dropped (interactive use) or the caller waits
+ * for a free buffer (offline runs that must not lose frames).
+ *
+ * USAGE:
+ * 1) Create a FrameCapture with a path and a format
+ * 2) Call GraphicsManager::StartCapture(&capture)
+ * 3) Every call to RefreshScreen() sends the frame to the capture
+ * 4) Call GraphicsManager::StopCapture() to finish writing and close the files
+ *
+ * @author Alex Wills
+ * @date May 4, 2023
+ */
+#ifndef _GRAPHICS_CAPTURE_H
+#define _GRAPHICS_CAPTURE_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "graphics_framebuffer.h"
+
+/*
+ * File formats that a FrameCapture can write.
+ */
+enum class CaptureFormat {
+    PPM_SEQUENCE,   // One binary PPM (P6) image per frame: <path>_00000.ppm, <path>_00001.ppm, ...
+    Y4M             // One uncompressed YUV4MPEG2 stream (4:2:0, full range, tagged XCOLORRANGE=FULL) at <path>
+};
+
+/*
+ * Streams frames to disk on a background thread through a bounded queue.
+ */
+class FrameCapture {
+
+    // Member variables
+    private:
+        CaptureFormat format;
+        std::string path;           // File prefix (PPM sequence) or file name (Y4M)
+        int frame_rate;             // Frames per second written in the Y4M header
+        bool block_when_full;       // True: wait for a free buffer. False: drop the frame.
+
+        int width, height;
+        bool is_open;
+
+        // Frame buffers shared with the writer thread. Buffers move from free_frames
+        // to queued_frames when submitted, and back once they are written.
+        std::vector<std::vector<uint32_t>> frame_pool;
+        std::vector<int> free_frames;
+        std::deque<int> queued_frames;
+        std::mutex queue_mutex;
+        std::condition_variable frame_queued;
+        std::condition_variable frame_freed;
+        bool stop_requested;
+        std::thread writer;
+
+        // Only touched by the writer thread
+        std::ofstream video_file;
+        std::vector<uint8_t> write_buffer;
+        int frames_written;
+
+        int frames_dropped;
+        std::atomic<bool> write_failed;     // Set by the writer thread when a write fails; nothing more is written
+
+    // Constructors
+    public:
+        /*
+         * Creates a capture sink. Nothing is written until Open() is called.
+         *
+         * @param path - file prefix for PPM sequences, or the file name of the Y4M stream
+         * @param format - the format to write frames in
+         * @param frame_rate - frames per second recorded in the video header (Y4M only)
+         * @param queue_size - how many frames can wait to be written at once
+         * @param block_when_full - if true, SubmitFrame waits for the writer instead of dropping frames
+         */
+        FrameCapture(std::string path, CaptureFormat format, int frame_rate = 60,
+            int queue_size = 8, bool block_when_full = false);
+
+        /*
+         * Destructor. Finishes writing any queued frames.
+         */
+        ~FrameCapture();
+
+        // A capture owns a thread and open files, so it cannot be copied
+        FrameCapture(const FrameCapture&) = delete;
+        FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Methods
+    public:
+        /*
+         * Allocates the frame buffers, opens the output, and starts the writer thread.
+         *
+         * @param width, height - the dimensions of every frame that will be submitted
+         * @return false if the output file could not be opened
+         */
+        bool Open(int width, int height);
+
+        /*
+         * Copies a frame into the queue to be written. Returns false if the frame was dropped,
+         * or if an earlier frame could not be written.
+         */
+        bool SubmitFrame(const FrameBuffer& frame);
+
+        /*
+         * Writes every queued frame, stops the writer thread, and closes the output.
+         */
+        void Close();
+
+        bool IsOpen() const
+        {
+            return this->is_open;
+        }
+
+        int GetFramesDropped() const
+        {
+            return this->frames_dropped;
+        }
+
+        /*
+         * Returns true if writing a frame failed (for example, because the disk is full).
+         * The capture stops writing at the first failure.
+         */
+        bool HasWriteError() const
+        {
+            return this->write_failed;
+        }
+
+    // Private helper methods
+    private:
+        /*
+         * Loop run by the writer thread: waits for queued frames and writes them out.
+         */
+        void WriterLoop();
+
+        /*
+         * Writes one frame as its own PPM image. Returns false if the image could not be written.
+         */
+        bool WritePPM(const std::vector<uint32_t>& pixels, int frame_number);
+
+        /*
+         * Converts one frame to YUV 4:2:0 and appends it to the Y4M stream.
+         * Returns false if the stream could not be written.
+         */
+        bool WriteY4MFrame(const std::vector<uint32_t>& pixels);
+};
+
+
+#endif
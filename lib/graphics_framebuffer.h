@@ -0,0 +1,253 @@
+/* graphics_framebuffer.h
+ *
+ * CPU-side color buffer for the graphics manager. The rasterizers write packed
+ * 32-bit colors into this buffer directly, and the backend uploads the whole buffer
+ * to the screen once per frame (see RefreshScreen() in graphics_backend.cpp).
+ *
+ * @author Alex Wills
+ * @date May 2, 2023
+ */
+#ifndef _GRAPHICS_FRAMEBUFFER_H
+#define _GRAPHICS_FRAMEBUFFER_H
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "graphics_utility.h"
+
+/*
+ * How the pixels of a buffer are arranged in memory.
+ * Every row is made of runs of 8 pixels (FrameBuffer::row_alignment), and the layouts only
+ * differ in where the runs go:
+ *
+ * LINEAR: the runs of a row follow each other, so rows are stored one after another.
+ * BLOCKED: the 8 runs of the same 8 rows are stored together, so every 8x8 block of pixels is
+ *   contiguous (256 bytes of colors, or a few cache lines). Blocks go left to right, then down.
+ *
+ * Code that is the same for both layouts finds pixel (x, y) at GetRow(y) + ColumnOffset(x).
+ */
+enum class BufferLayout {
+    LINEAR,
+    BLOCKED
+};
+
+/*
+ * 2D array of packed ARGB8888 colors (0xAARRGGBB), with row 0 at the top of the screen.
+ * The rasterizers write in the chosen BufferLayout, and the image is turned back into
+ * plain rows once per frame (Resolve()) for presenting and capturing.
+ */
+class FrameBuffer {
+
+    // Constants
+    public:
+        // Rows are padded to a multiple of this many pixels, so that the SIMD rasterizer can
+        // read and write whole blocks of pixels without running off the end of a row.
+        // This is also the width and height of a block in the BLOCKED layout.
+        static constexpr int row_alignment = 8;
+
+    // Member variables
+    private:
+        std::vector<uint32_t> buffer;
+        int width, height;
+        int stride;     // Number of pixels in a row, including padding
+        BufferLayout layout;
+        int run_stride; // Number of pixels from the start of one run of a row to the start of the next
+        std::vector<uint32_t> linear;   // The BLOCKED image as plain rows, written by Resolve()
+
+    // Constructors
+    public:
+        /*
+         * Default constructor. Initializes a frame buffer with 1 black pixel.
+         */
+        FrameBuffer()
+        {
+            this->width = 1;
+            this->height = 1;
+            this->stride = FrameBuffer::row_alignment;
+            this->layout = BufferLayout::LINEAR;
+            this->run_stride = FrameBuffer::row_alignment;
+            this->buffer.assign(this->stride, FrameBuffer::PackColor(0, 0, 0));
+        }
+
+        /*
+         * Initializes a frame buffer with a width and height, filled with black.
+         *
+         * @param width - the width of the canvas in pixels
+         * @param height - the height of the canvas in pixels
+         * @param layout - how the pixels are arranged in memory
+         */
+        FrameBuffer(int width, int height, BufferLayout layout = BufferLayout::LINEAR)
+        {
+            this->width = width;
+            this->height = height;
+            this->stride = FrameBuffer::AlignRow(width);
+            this->layout = layout;
+            this->run_stride = FrameBuffer::RunStride(layout);
+
+            // The BLOCKED layout also pads the height to whole blocks
+            int rows = (layout == BufferLayout::BLOCKED) ? FrameBuffer::AlignRow(height) : height;
+            this->buffer.assign(this->stride * rows, FrameBuffer::PackColor(0, 0, 0));
+            if (layout == BufferLayout::BLOCKED)
+            {
+                this->linear.assign(this->stride * height, FrameBuffer::PackColor(0, 0, 0));
+            }
+        }
+
+    // Methods
+    public:
+        /*
+         * Returns a pointer to the first pixel of a row (0 is the top row). Pixel x of the row
+         * is at GetRow(row) + ColumnOffset(x), and each run of 8 pixels is contiguous.
+         * This does not check bounds; the caller is responsible for only writing
+         * to columns [0, stride), and only columns [0, width) are shown on the screen.
+         */
+        uint32_t* GetRow(int row)
+        {
+            return this->buffer.data() + FrameBuffer::RowOffset(row, this->stride, this->layout);
+        }
+
+        const uint32_t* GetRow(int row) const
+        {
+            return this->buffer.data() + FrameBuffer::RowOffset(row, this->stride, this->layout);
+        }
+
+        /*
+         * Returns how far pixel x of a row is from the start of the row.
+         */
+        int ColumnOffset(int column) const
+        {
+            return (column / FrameBuffer::row_alignment) * this->run_stride + column % FrameBuffer::row_alignment;
+        }
+
+        BufferLayout GetLayout() const
+        {
+            return this->layout;
+        }
+
+        /*
+         * Brings the plain rows returned by GetLinearRow() and GetLinearData() up to date.
+         * Only the BLOCKED layout has any work to do.
+         */
+        void Resolve()
+        {
+            if (this->layout == BufferLayout::LINEAR)
+            {
+                return;
+            }
+            // Copy each run of every block back to its row
+            for (int row = 0; row < this->height; ++row)
+            {
+                const uint32_t* runs = this->GetRow(row);
+                uint32_t* destination = this->linear.data() + row * this->stride;
+                for (int column = 0; column < this->stride; column += FrameBuffer::row_alignment)
+                {
+                    std::copy(runs + this->ColumnOffset(column), runs + this->ColumnOffset(column) + FrameBuffer::row_alignment,
+                        destination + column);
+                }
+            }
+        }
+
+        /*
+         * Returns a pointer to the first pixel of a row of the image as plain rows, in which
+         * pixel x is at index x (read only access). For the BLOCKED layout, this is the image
+         * as of the last call to Resolve().
+         */
+        const uint32_t* GetLinearRow(int row) const
+        {
+            return this->GetLinearData() + row * this->stride;
+        }
+
+        /*
+         * Returns a pointer to the first pixel of the image as plain rows (read only access).
+         * Rows are GetPitch() bytes apart.
+         */
+        const uint32_t* GetLinearData() const
+        {
+            return (this->layout == BufferLayout::LINEAR) ? this->buffer.data() : this->linear.data();
+        }
+
+        int GetWidth() const
+        {
+            return this->width;
+        }
+
+        int GetHeight() const
+        {
+            return this->height;
+        }
+
+        /*
+         * Returns the number of bytes between the start of two rows of the linear image.
+         */
+        int GetPitch() const
+        {
+            return this->stride * sizeof(uint32_t);
+        }
+
+        /*
+         * Returns the number of pixels in a row, including padding (width, rounded up to row_alignment).
+         */
+        int GetStride() const
+        {
+            return this->stride;
+        }
+
+        /*
+         * Sets every pixel in the buffer to a packed color.
+         */
+        void Fill(uint32_t packed_color)
+        {
+            std::fill(this->buffer.begin(), this->buffer.end(), packed_color);
+        }
+
+    // Static functions
+    public:
+        /*
+         * Returns how far the first pixel of a row is from the start of a buffer.
+         * Shared with the DepthBuffer, which uses the same layouts.
+         */
+        static int RowOffset(int row, int stride, BufferLayout layout)
+        {
+            if (layout == BufferLayout::LINEAR)
+            {
+                return row * stride;
+            }
+            // Skip the rows of whole blocks above, then the runs of the rows above in the same block
+            return (row / FrameBuffer::row_alignment) * stride * FrameBuffer::row_alignment
+                + (row % FrameBuffer::row_alignment) * FrameBuffer::row_alignment;
+        }
+
+        /*
+         * Returns the distance between the runs of a row in a layout.
+         */
+        static int RunStride(BufferLayout layout)
+        {
+            return (layout == BufferLayout::LINEAR) ? FrameBuffer::row_alignment
+                : FrameBuffer::row_alignment * FrameBuffer::row_alignment;
+        }
+
+        /*
+         * Rounds a row length up to a multiple of row_alignment.
+         */
+        static int AlignRow(int width)
+        {
+            return (width + FrameBuffer::row_alignment - 1) / FrameBuffer::row_alignment * FrameBuffer::row_alignment;
+        }
+
+        /*
+         * Packs RGBA values into a single ARGB8888 pixel. Each channel keeps its lowest
+         * 8 bits, matching how SDL treats the values passed to SDL_SetRenderDrawColor.
+         */
+        static uint32_t PackColor(int red, int green, int blue, int alpha = 255)
+        {
+            return (uint32_t(alpha & 0xFF) << 24) | (uint32_t(red & 0xFF) << 16)
+                | (uint32_t(green & 0xFF) << 8) | uint32_t(blue & 0xFF);
+        }
+
+        static uint32_t PackColor(Color color)
+        {
+            return FrameBuffer::PackColor(color.red, color.green, color.blue);
+        }
+};
+
+
+#endif
@@ -6,114 +6,542 @@
 #ifndef _GRAPHICS_HSR_H
 #define _GRAPHICS_HSR_H
 #include "./graphics.h"
+#include "./graphics_framebuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
+/*
+ * How the depth (1/z) of each pixel is stored.
+ */
+enum class DepthFormat {
+    FLOAT32,    // 32-bit float 1/z (the default)
+    UNORM16,    // 16-bit fixed point, half the memory traffic of FLOAT32
+    UNORM24     // 24-bit fixed point, stored in the low bits of a 32-bit integer
+};
+
+/*
+ * How a Scene turns its triangles into pixel colors.
+ */
+enum class ShadingMode {
+    FORWARD,    // Shade a pixel every time a triangle passes the depth test there (the default)
+    DEFERRED    // Only store which triangle is visible at each pixel, then shade every pixel once
+};
+
 /*
  * 2D array to store information about the depth of the pixels currently on screen.
+ * Rows are laid out like the FrameBuffer (row 0 is the top of the screen, rows are padded
+ * to FrameBuffer::row_alignment, and the same BufferLayouts are available), so the rasterizer
+ * can walk both buffers together. Value x of a row is at GetRow<T>(row) + ColumnOffset(x).
+ *
+ * Depth is stored as 1/z, where a higher value is closer to the camera. In the fixed point
+ * formats, 1/z is scaled so that the closest depth in the depth range (see SetDepthRange())
+ * maps to the largest integer, and 0 (infinitely far away) is still the cleared value.
+ * Rasterizers access the values for their format with GetRow<T>() or GetSpan<T>(), where
+ * T is float (FLOAT32), uint16_t (UNORM16), or uint32_t (UNORM24).
+ *
+ * Clearing is lazy. The buffer is split into square tiles, and each tile remembers the
+ * generation (clear count) it was last cleared in. ClearBuffer() only starts a new
+ * generation, and a tile from an older generation reads as cleared until PrepareRect()
+ * clears it right before it is drawn to. Tiles that nothing is drawn to are never touched.
+ *
+ * Alongside the depths, the buffer keeps a hierarchical Z (HiZ) level: for every 8x8 block,
+ * and for every clearing tile, the farthest (lowest) stored depth that any of its pixels can
+ * have. The values are conservative: a pixel is never farther than its block says, but may be
+ * closer. The rasterizer skips a triangle, or a block of it, when the triangle's nearest depth
+ * there is no closer than the farthest depth, because every pixel would fail the depth test.
  */
 class DepthBuffer {
-    
+
+    // Constants
+    public:
+        // Width and height of a clearing tile in pixels. This is a multiple of the SIMD block
+        // width and divides TileBinner::tile_size, so threads drawing different screen tiles
+        // never clear the same depth tile.
+        static constexpr int tile_size = 32;
+
+        // Width and height of a HiZ block in pixels (one run of a row, so blocks line up with
+        // the BLOCKED layout). Divides tile_size.
+        static constexpr int block_size = FrameBuffer::row_alignment;
+
     // Member variables
     private:
         static constexpr float cleared_value = 0;   // The value representing a space that has no pixels
 
+        // Only the buffer that matches the format is allocated
+        DepthFormat format;
         std::vector<float> buffer;
+        std::vector<uint16_t> buffer16;
+        std::vector<uint32_t> buffer24;
+        float fixed_scale;      // Multiplies 1/z to get a fixed point depth
+
         int width, height;
+        int stride;     // Number of values in a row, including padding
+        BufferLayout layout;
+        int run_stride; // Number of values from the start of one run of a row to the start of the next
         int max_x, max_y;
+        float invalid_value;    // Returned by operator() for pixels that cannot be accessed
+
+        int tiles_x, tiles_y;
+        std::vector<uint32_t> tile_generations;     // The generation each tile was last cleared in
+        uint32_t generation;                        // The current generation
+
+        // Farthest stored depth (as a float) that each block and tile can hold, in the units of the format
+        int blocks_x, blocks_y;
+        std::vector<float> block_farthest;
+        std::vector<float> tile_farthest;
 
     // Constructors
     public:
         /*
-         * Default constructor. Initializes a depth buffer with 1 empty element.
+         * Default constructor. Initializes an empty depth buffer.
          */
         DepthBuffer()
         {
+            this->format = DepthFormat::FLOAT32;
+            this->fixed_scale = 1;
             this->width = 0;
             this->height = 0;
+            this->stride = 0;
+            this->layout = BufferLayout::LINEAR;
+            this->run_stride = FrameBuffer::RunStride(BufferLayout::LINEAR);
             this->max_x = 0;
             this->max_y = 0;
-            this->buffer.resize(1);
-            this->buffer[0] = DepthBuffer::cleared_value;
+            this->invalid_value = DepthBuffer::cleared_value;
+            this->tiles_x = 0;
+            this->tiles_y = 0;
+            this->generation = 0;
+            this->blocks_x = 0;
+            this->blocks_y = 0;
         }
 
         /*
          * Initializes a depth buffer with a width and height.
-         * 
+         *
          * @param width - the width of the canvas
          * @param height - the height of the canvas
+         * @param format - how each depth value is stored
+         * @param layout - how the values are arranged in memory (match the FrameBuffer)
          */
-        DepthBuffer(int width, int height)
+        DepthBuffer(int width, int height, DepthFormat format = DepthFormat::FLOAT32,
+            BufferLayout layout = BufferLayout::LINEAR)
         {
+            this->format = format;
             this->width = width;
             this->height = height;
+            this->stride = FrameBuffer::AlignRow(width);
+            this->layout = layout;
+            this->run_stride = FrameBuffer::RunStride(layout);
             this->max_x = width / 2;
             this->max_y = height / 2;
+            this->invalid_value = DepthBuffer::cleared_value;
 
-            // Initialize empty buffer (as a 1D vector)
-            buffer.resize((width + 1) * (height + 1));
-            for (int i = 0; i < buffer.size(); ++i)
+            // Initialize empty buffer (as a 1D vector). The BLOCKED layout pads the height to whole blocks.
+            int size = this->stride * ((layout == BufferLayout::BLOCKED) ? FrameBuffer::AlignRow(height) : height);
+            switch (format)
             {
-                buffer[i] = DepthBuffer::cleared_value;
+                case DepthFormat::FLOAT32:
+                    this->buffer.assign(size, DepthBuffer::cleared_value);
+                    break;
+                case DepthFormat::UNORM16:
+                    this->buffer16.assign(size, 0);
+                    break;
+                case DepthFormat::UNORM24:
+                    this->buffer24.assign(size, 0);
+                    break;
             }
+            this->SetDepthRange(1);
+
+            // Every tile starts out cleared in generation 0 (tiles cover the row padding too)
+            this->tiles_x = (this->stride + DepthBuffer::tile_size - 1) / DepthBuffer::tile_size;
+            this->tiles_y = (height + DepthBuffer::tile_size - 1) / DepthBuffer::tile_size;
+            this->generation = 0;
+            this->tile_generations.assign(this->tiles_x * this->tiles_y, 0);
 
-            std::cout << "~ Creating Depth Buffer with top left [0][0] at (" << -this->max_x << ", " << -this->max_y << ")" << 
-                "\n\tand top right [" << this->width << "][" << this->height << "] at (" << this->width - this->max_x << ", " << this->height - this->max_y << ")" << std::endl;
+            // Nothing has been drawn, so nothing is known about the depths yet
+            this->blocks_x = this->stride / DepthBuffer::block_size;
+            this->blocks_y = (height + DepthBuffer::block_size - 1) / DepthBuffer::block_size;
+            this->block_farthest.assign(this->blocks_x * this->blocks_y, DepthBuffer::cleared_value);
+            this->tile_farthest.assign(this->tiles_x * this->tiles_y, DepthBuffer::cleared_value);
+
+            std::cout << "~ Creating Depth Buffer with top left [0][0] at (" << -this->max_x << ", " << this->max_y << ")" <<
+                "\n\tand bottom right [" << this->width - 1 << "][" << this->height - 1 << "] at (" << this->width - 1 - this->max_x << ", " << this->max_y - this->height + 1 << ")" << std::endl;
         }
 
     // Overloaded operators
     public:
         /*
-        * Indexes into the depth buffer at row, column (read/write access).
+        * Indexes into the depth buffer at (x, y), where (0, 0) is the center of the screen
+        * (read/write access). Only available in the FLOAT32 format.
         */
         float& operator()(int x, int y)
         {
-            // Translate (x, y) to array location 
-            int row = y + this->max_y;
+            // Translate (x, y) to array location (y points up on the screen, but rows go down)
+            int row = this->max_y - y;
             int column = x + this->max_x;
 
             // Ensure index is in-bounds
-            
-
-
-            if (row > this->height || row < 0 || column > this->width || column < 0)
+            if (row >= this->height || row < 0 || column >= this->width || column < 0)
             {
-                std::cout << "ERROR: Indexing out of bounds (" << x << ", " << y << "). Returning DepthBuffer(0, 0)." << std::endl;
-                return buffer[0];
+                std::cout << "ERROR: Indexing out of bounds (" << x << ", " << y << "). Returning an unused value." << std::endl;
+                return this->invalid_value;
             }
+            if (this->format != DepthFormat::FLOAT32)
+            {
+                std::cout << "!!ERROR: Writable depth values are only available in the FLOAT32 depth format." << std::endl;
+                return this->invalid_value;
+            }
+
+            this->PrepareRect(column, column, row, row);
 
-            return buffer[(row * this->width) + column];
+            // The caller may write a farther depth, so the HiZ level no longer knows anything about this block
+            this->ForgetFarthest(column / DepthBuffer::block_size, row / DepthBuffer::block_size);
+            return this->GetRow<float>(row)[this->ColumnOffset(column)];
         }
 
         /*
         * Indexes into the depth buffer at row, column (read only access).
+        * Returns the depth as 1/z, whatever the format.
         */
         float operator()(int row, int column) const
         {
             // Ensure index is in-bounds
             if (row >= this->height || row < 0 || column >= this->width || column < 0)
             {
-                std::cout << "ERROR: Indexing out of bounds (" << row << ", " << column << "). Returning DepthBuffer(0, 0)." << std::endl;
-                return buffer[0];
+                std::cout << "ERROR: Indexing out of bounds (" << row << ", " << column << "). Returning a cleared value." << std::endl;
+                return DepthBuffer::cleared_value;
+            }
+
+            // A tile from an older generation has not been cleared yet, but counts as cleared
+            int tile = (row / DepthBuffer::tile_size) * this->tiles_x + column / DepthBuffer::tile_size;
+            if (this->tile_generations[tile] != this->generation)
+            {
+                return DepthBuffer::cleared_value;
             }
 
-            return buffer[(row * this->width) + column];
+            int index = FrameBuffer::RowOffset(row, this->stride, this->layout) + this->ColumnOffset(column);
+            switch (this->format)
+            {
+                case DepthFormat::UNORM16:
+                    return this->buffer16[index] / this->fixed_scale;
+                case DepthFormat::UNORM24:
+                    return this->buffer24[index] / this->fixed_scale;
+                default:
+                    return this->buffer[index];
+            }
         }
 
     // Methods
     public:
+        DepthFormat GetFormat() const
+        {
+            return this->format;
+        }
+
+        /*
+         * Returns the largest integer that a fixed point depth can hold (0 for FLOAT32).
+         */
+        float GetFixedMax() const
+        {
+            switch (this->format)
+            {
+                case DepthFormat::UNORM16:
+                    return 65535.0f;
+                case DepthFormat::UNORM24:
+                    return 16777215.0f;
+                default:
+                    return 0;
+            }
+        }
+
+        /*
+         * Sets the largest 1/z value that will be stored, which is 1 / (distance to the near
+         * clipping plane). Fixed point depths spread their precision over [0, max_depth],
+         * and closer depths are clamped. Has no effect on the FLOAT32 format.
+         */
+        void SetDepthRange(float max_depth)
+        {
+            this->fixed_scale = (this->format == DepthFormat::FLOAT32) ? 1 : this->GetFixedMax() / max_depth;
+        }
+
+        /*
+         * Returns the number that 1/z is multiplied by to get a fixed point depth.
+         */
+        float GetFixedScale() const
+        {
+            return this->fixed_scale;
+        }
+
+        /*
+         * Converts a 1/z value to the value the format stores for it, as a float. This matches
+         * the rounding of the rasterizer, so stored depths can be compared with HiZ values.
+         */
+        float ToStored(float z_value) const
+        {
+            if (this->format == DepthFormat::FLOAT32)
+            {
+                return z_value;
+            }
+            return std::floor(std::min(std::max(z_value * this->fixed_scale, 0.0f), this->GetFixedMax()));
+        }
+
+        /*
+         * Returns the farthest stored depth that any pixel in an 8x8 block can have.
+         * PrepareRect() must have been called on the block first.
+         */
+        float GetFarthest(int block_x, int block_y) const
+        {
+            return this->block_farthest[block_y * this->blocks_x + block_x];
+        }
+
+        /*
+         * Returns the farthest stored depth that any pixel in a rectangle (in buffer space)
+         * can have, from the coarse per-tile HiZ values. Tiles that have not been cleared yet
+         * count as cleared, so this does not need PrepareRect().
+         *
+         * @param min_x, max_x, min_y, max_y - inclusive columns and rows of the rectangle
+         */
+        float GetFarthest(int min_x, int max_x, int min_y, int max_y) const
+        {
+            float farthest = std::numeric_limits<float>::max();
+            int tile;
+            for (int tile_y = min_y / DepthBuffer::tile_size; tile_y <= max_y / DepthBuffer::tile_size; ++tile_y)
+            {
+                for (int tile_x = min_x / DepthBuffer::tile_size; tile_x <= max_x / DepthBuffer::tile_size; ++tile_x)
+                {
+                    tile = tile_y * this->tiles_x + tile_x;
+                    if (this->tile_generations[tile] != this->generation)
+                    {
+                        return DepthBuffer::cleared_value;
+                    }
+                    farthest = std::min(farthest, this->tile_farthest[tile]);
+                }
+            }
+            return farthest;
+        }
+
+        /*
+         * Returns true if a rectangle (in buffer space) holds every pixel of an 8x8 block
+         * that is on the screen.
+         */
+        bool CoversBlock(int block_x, int block_y, int min_x, int max_x, int min_y, int max_y) const
+        {
+            return min_x <= block_x * DepthBuffer::block_size
+                && max_x >= std::min((block_x + 1) * DepthBuffer::block_size, this->width) - 1
+                && min_y <= block_y * DepthBuffer::block_size
+                && max_y >= std::min((block_y + 1) * DepthBuffer::block_size, this->height) - 1;
+        }
+
+        /*
+         * Records that no pixel of an 8x8 block is farther than a stored depth. Only call this
+         * once every on-screen pixel in the block really is at least that close.
+         */
+        void RaiseFarthest(int block_x, int block_y, float farthest)
+        {
+            float& block = this->block_farthest[block_y * this->blocks_x + block_x];
+            if (farthest <= block)
+            {
+                return;
+            }
+            block = farthest;
+
+            // The tile is as far as its farthest block
+            int tile_x = block_x * DepthBuffer::block_size / DepthBuffer::tile_size;
+            int tile_y = block_y * DepthBuffer::block_size / DepthBuffer::tile_size;
+            this->tile_farthest[tile_y * this->tiles_x + tile_x] = this->FarthestInTile(tile_x, tile_y);
+        }
+
+        /*
+         * Returns a pointer to the first value of a row (0 is the top of the screen).
+         * T must match the format: float (FLOAT32), uint16_t (UNORM16), or uint32_t (UNORM24).
+         * This does not check bounds; the caller is responsible for only accessing
+         * rows [0, height) and columns [0, stride), and for calling PrepareRect() on
+         * those pixels first.
+         */
+        template <typename T>
+        T* GetRow(int row)
+        {
+            return this->Values((T*) nullptr).data() + FrameBuffer::RowOffset(row, this->stride, this->layout);
+        }
+
+        /*
+         * Returns how far value x of a row is from the start of the row.
+         */
+        int ColumnOffset(int column) const
+        {
+            return (column / FrameBuffer::row_alignment) * this->run_stride + column % FrameBuffer::row_alignment;
+        }
+
+        BufferLayout GetLayout() const
+        {
+            return this->layout;
+        }
+
+        /*
+         * Checks once that columns [first_column, last_column] of a row are inside the buffer
+         * (including the row padding) and that T matches the format, and returns a pointer to
+         * the first value of the row, like GetRow(). Every column in the span can then be accessed
+         * (at ColumnOffset(column)) without further checks. As with GetRow(), PrepareRect() must
+         * be called on the span first.
+         *
+         * @return nullptr if the span is not inside the buffer or T is the wrong type
+         */
+        template <typename T>
+        T* GetSpan(int row, int first_column, int last_column)
+        {
+            std::vector<T>& values = this->Values((T*) nullptr);
+            if (values.empty() || row < 0 || row >= this->height
+                || first_column < 0 || last_column >= this->stride || first_column > last_column)
+            {
+                return nullptr;
+            }
+            return values.data() + FrameBuffer::RowOffset(row, this->stride, this->layout);
+        }
+
+        /*
+         * Clears every tile that overlaps a rectangle of pixels (in buffer space) and has not
+         * been cleared since the last ClearBuffer(). Call this before using GetRow() to read or
+         * write those pixels. Tiles are cleared in full, including any row padding they cover.
+         *
+         * @param min_x, max_x, min_y, max_y - inclusive columns and rows of the rectangle
+         */
+        void PrepareRect(int min_x, int max_x, int min_y, int max_y)
+        {
+            int tile;
+            for (int tile_y = min_y / DepthBuffer::tile_size; tile_y <= max_y / DepthBuffer::tile_size; ++tile_y)
+            {
+                for (int tile_x = min_x / DepthBuffer::tile_size; tile_x <= max_x / DepthBuffer::tile_size; ++tile_x)
+                {
+                    tile = tile_y * this->tiles_x + tile_x;
+                    if (this->tile_generations[tile] != this->generation)
+                    {
+                        this->ClearTile(tile_x, tile_y);
+                        this->tile_generations[tile] = this->generation;
+                    }
+                }
+            }
+        }
+
         /*
-         * Clears the buffer by setting all values to the const cleared_value.
+         * Clears the buffer. Only the generation changes here; each tile is actually cleared
+         * the next time PrepareRect() touches it.
          */
         void ClearBuffer()
         {
-            for (int i = 0; i < this->buffer.size(); ++i)
+            this->generation++;
+            if (this->generation == 0)
             {
-                this->buffer[i] = DepthBuffer::cleared_value;
+                // The counter wrapped around, so an old tile could look current. Clear everything
+                // for real and start counting again.
+                std::fill(this->buffer.begin(), this->buffer.end(), DepthBuffer::cleared_value);
+                std::fill(this->buffer16.begin(), this->buffer16.end(), 0);
+                std::fill(this->buffer24.begin(), this->buffer24.end(), 0);
+                this->tile_generations.assign(this->tile_generations.size(), 0);
+                std::fill(this->block_farthest.begin(), this->block_farthest.end(), DepthBuffer::cleared_value);
+                std::fill(this->tile_farthest.begin(), this->tile_farthest.end(), DepthBuffer::cleared_value);
             }
         }
 
+    // Private helper methods
+    private:
+        /*
+         * Returns the storage for a value type (the pointer only picks the overload).
+         */
+        std::vector<float>& Values(float*)
+        {
+            return this->buffer;
+        }
+        std::vector<uint16_t>& Values(uint16_t*)
+        {
+            return this->buffer16;
+        }
+        std::vector<uint32_t>& Values(uint32_t*)
+        {
+            return this->buffer24;
+        }
+
+        /*
+         * Returns the lowest HiZ value of the blocks in a tile.
+         */
+        float FarthestInTile(int tile_x, int tile_y) const
+        {
+            const int blocks_per_tile = DepthBuffer::tile_size / DepthBuffer::block_size;
+            int first_block_x = tile_x * blocks_per_tile;
+            int last_block_x = std::min(first_block_x + blocks_per_tile, this->blocks_x);
+            int first_block_y = tile_y * blocks_per_tile;
+            int last_block_y = std::min(first_block_y + blocks_per_tile, this->blocks_y);
+
+            float farthest = std::numeric_limits<float>::max();
+            for (int block_y = first_block_y; block_y < last_block_y; ++block_y)
+            {
+                for (int block_x = first_block_x; block_x < last_block_x; ++block_x)
+                {
+                    farthest = std::min(farthest, this->block_farthest[block_y * this->blocks_x + block_x]);
+                }
+            }
+            return farthest;
+        }
+
+        /*
+         * Resets the HiZ value of a block (and its tile) to the cleared value.
+         */
+        void ForgetFarthest(int block_x, int block_y)
+        {
+            this->block_farthest[block_y * this->blocks_x + block_x] = DepthBuffer::cleared_value;
+            int tile_x = block_x * DepthBuffer::block_size / DepthBuffer::tile_size;
+            int tile_y = block_y * DepthBuffer::block_size / DepthBuffer::tile_size;
+            this->tile_farthest[tile_y * this->tiles_x + tile_x] = DepthBuffer::cleared_value;
+        }
+
+        /*
+         * Sets every value in a tile to the cleared value.
+         */
+        template <typename T>
+        void ClearTile(std::vector<T>& values, int first_column, int last_column, int first_row, int last_row)
+        {
+            T* row_values;
+            for (int row = first_row; row < last_row; ++row)
+            {
+                // Tiles start and end on whole runs, and each run is contiguous in every layout
+                row_values = values.data() + FrameBuffer::RowOffset(row, this->stride, this->layout);
+                for (int column = first_column; column < last_column; column += FrameBuffer::row_alignment)
+                {
+                    std::fill(row_values + this->ColumnOffset(column),
+                        row_values + this->ColumnOffset(column) + FrameBuffer::row_alignment, T(DepthBuffer::cleared_value));
+                }
+            }
+        }
 
+        void ClearTile(int tile_x, int tile_y)
+        {
+            int first_column = tile_x * DepthBuffer::tile_size;
+            int last_column = std::min(first_column + DepthBuffer::tile_size, this->stride);
+            int first_row = tile_y * DepthBuffer::tile_size;
+            int last_row = std::min(first_row + DepthBuffer::tile_size, this->height);
+
+            for (int block_y = first_row / DepthBuffer::block_size; block_y * DepthBuffer::block_size < last_row; ++block_y)
+            {
+                std::fill(this->block_farthest.begin() + block_y * this->blocks_x + first_column / DepthBuffer::block_size,
+                    this->block_farthest.begin() + block_y * this->blocks_x + last_column / DepthBuffer::block_size,
+                    DepthBuffer::cleared_value);
+            }
+            this->tile_farthest[tile_y * this->tiles_x + tile_x] = DepthBuffer::cleared_value;
+            switch (this->format)
+            {
+                case DepthFormat::FLOAT32:
+                    this->ClearTile(this->buffer, first_column, last_column, first_row, last_row);
+                    break;
+                case DepthFormat::UNORM16:
+                    this->ClearTile(this->buffer16, first_column, last_column, first_row, last_row);
+                    break;
+                case DepthFormat::UNORM24:
+                    this->ClearTile(this->buffer24, first_column, last_column, first_row, last_row);
+                    break;
+            }
+        }
 };
 
 
-#endif
\ No newline at end of file
+#endif
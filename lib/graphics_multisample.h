@@ -0,0 +1,160 @@
+/* graphics_multisample.h
+ *
+ * Storage for multisample anti-aliasing (MSAA).
+ *
+ * With multisampling on, depth tested triangles are tested against 4 or 8 sample points in
+ * each pixel instead of only the pixel's center. The rasterizer works out a coverage mask
+ * (which samples are inside the triangle), shades the pixel once, and writes that color and
+ * a depth to each covered sample that passes its own depth test. When the screen is refreshed,
+ * the samples of each pixel are averaged into the frame buffer, which smooths the edges of
+ * triangles without drawing 4 or 8 times as many pixels.
+ *
+ * Samples are kept compact: the samples of a pixel are next to each other in memory (16 bytes
+ * of colors and 16 of depths for 4x), and each pixel has a one byte state. A pixel
+ * only gets its samples set up the first time a triangle touches it in a frame, and a pixel
+ * whose samples all hold the same color is resolved without averaging.
+ *
+ * @author Alex Wills
+ * @date May 24, 2023
+ */
+#ifndef _GRAPHICS_MULTISAMPLE_H
+#define _GRAPHICS_MULTISAMPLE_H
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Per-sample colors and depths (1/z) for every pixel of the canvas.
+ * Pixels are indexed row * width + column in buffer space, whatever the FrameBuffer layout.
+ */
+class SampleBuffer {
+
+    // Constants
+    public:
+        static constexpr int max_samples = 8;
+
+        /*
+         * What is known about a pixel's samples this frame.
+         */
+        enum PixelState : uint8_t {
+            UNTOUCHED = 0,  // No multisampled triangle has touched the pixel; its samples are out of date
+            UNIFORM = 1,    // Every sample holds the same color
+            MIXED = 2       // The samples hold different colors and must be averaged
+        };
+
+    // Member variables
+    private:
+        int sample_count;   // 1 (off), 4, or 8
+        int width, height;
+        std::vector<uint32_t> colors;   // sample_count packed colors per pixel
+        std::vector<float> depths;      // sample_count 1/z values per pixel
+        std::vector<uint8_t> states;    // One PixelState per pixel
+
+    // Constructors
+    public:
+        /*
+         * Default constructor. Multisampling is off.
+         */
+        SampleBuffer()
+        {
+            this->sample_count = 1;
+            this->width = 0;
+            this->height = 0;
+        }
+
+        /*
+         * Creates a sample buffer for a canvas.
+         *
+         * @param sample_count - samples per pixel (4 or 8; anything else turns multisampling off)
+         */
+        SampleBuffer(int width, int height, int sample_count)
+        {
+            this->sample_count = (sample_count == 4 || sample_count == 8) ? sample_count : 1;
+            this->width = width;
+            this->height = height;
+            if (this->sample_count > 1)
+            {
+                this->colors.assign(size_t(width) * height * this->sample_count, 0);
+                this->depths.assign(size_t(width) * height * this->sample_count, 0);
+                this->states.assign(size_t(width) * height, PixelState::UNTOUCHED);
+            }
+        }
+
+    // Methods
+    public:
+        int GetSampleCount() const
+        {
+            return this->sample_count;
+        }
+
+        /*
+         * Returns true if triangles should be rasterized with multiple samples per pixel.
+         */
+        bool IsActive() const
+        {
+            return this->sample_count > 1;
+        }
+
+        /*
+         * Returns the positions of the samples inside a pixel, as (x, y) pairs in sixteenths of
+         * a pixel from the pixel's center (y points down). These are the standard 4x and 8x
+         * patterns, which spread the samples over different rows and columns.
+         */
+        const int* GetPattern() const
+        {
+            static const int pattern4[2 * 4] = {-2, -6, 6, -2, -6, 2, 2, 6};
+            static const int pattern8[2 * 8] = {1, -3, -1, 3, 5, 1, -3, -5, -5, 5, -7, -1, 3, 7, 7, -7};
+            return (this->sample_count == 8) ? pattern8 : pattern4;
+        }
+
+        /*
+         * Marks every pixel as untouched. The samples themselves are set up again the first
+         * time a triangle touches each pixel, so this only writes one byte per pixel.
+         */
+        void Clear()
+        {
+            std::fill(this->states.begin(), this->states.end(), PixelState::UNTOUCHED);
+        }
+
+        /*
+         * Returns the first sample color and depth of a pixel (in buffer space).
+         * The caller must stay inside the canvas.
+         */
+        uint32_t* GetColors(int row, int column)
+        {
+            return this->colors.data() + (size_t(row) * this->width + column) * this->sample_count;
+        }
+        float* GetDepths(int row, int column)
+        {
+            return this->depths.data() + (size_t(row) * this->width + column) * this->sample_count;
+        }
+
+        uint8_t& GetState(int row, int column)
+        {
+            return this->states[size_t(row) * this->width + column];
+        }
+
+        /*
+         * Averages the samples of one pixel into a packed color.
+         */
+        uint32_t Average(int row, int column)
+        {
+            const uint32_t* samples = this->GetColors(row, column);
+            uint32_t alpha = 0, red = 0, green = 0, blue = 0;
+            for (int i = 0; i < this->sample_count; ++i)
+            {
+                alpha += samples[i] >> 24;
+                red += (samples[i] >> 16) & 0xFF;
+                green += (samples[i] >> 8) & 0xFF;
+                blue += samples[i] & 0xFF;
+            }
+
+            // Round to the nearest value
+            uint32_t half = this->sample_count / 2;
+            return ((alpha + half) / this->sample_count << 24) | ((red + half) / this->sample_count << 16)
+                | ((green + half) / this->sample_count << 8) | ((blue + half) / this->sample_count);
+        }
+};
+
+
+#endif
@@ -0,0 +1,104 @@
+/* graphics_raster.h
+ *
+ * Structures for the edge function (half-space) triangle rasterizer.
+ *
+ * A triangle is set up once as three edge functions E(x, y) = a*x + b*y + c, which are
+ * positive on the inside of the triangle, and a bounding box. Every pixel in the bounding
+ * box is inside the triangle when all three edge functions are >= 0. Moving one pixel
+ * to the right adds a to an edge function, so the traversal needs no divisions and no
+ * scratch memory. Attributes (depth, gradient intensity) are evaluated from plane equations.
+ *
+ * Vertices have 4 bits of sub-pixel precision (28.4 fixed point, see SubPixelPoint), and
+ * pixels are sampled at their integer coordinates. Pixels that lie exactly on an edge follow
+ * the top-left rule: they belong to the triangle only if the edge is a top edge (horizontal,
+ * with the triangle below it) or a left edge. Triangles that share an edge therefore never
+ * both draw the pixels along it, and never leave a gap between them.
+ *
+ * All coordinates in this file are in buffer space: (0, 0) is the top left pixel of the
+ * canvas, x increases to the right, and y increases downwards.
+ *
+ * @author Alex Wills
+ * @date May 9, 2023
+ */
+#ifndef _GRAPHICS_RASTER_H
+#define _GRAPHICS_RASTER_H
+#include <cstdint>
+#include "graphics_utility.h"
+
+/*
+ * One edge of a triangle as the line equation E(x, y) = a*x + b*y + c, for a pixel (x, y).
+ * E is positive on the side of the edge that is inside the triangle, and is measured in
+ * sub-pixel units squared (1/256 of a pixel).
+ */
+struct EdgeFunction {
+    int64_t a, b, c;
+
+    /*
+     * Evaluates the edge function at a pixel.
+     */
+    int64_t At(int x, int y) const
+    {
+        return this->a * x + this->b * y + this->c;
+    }
+};
+
+/*
+ * Plane equation for a value interpolated linearly across the screen (such as 1/z),
+ * stored relative to an origin pixel to keep the float math accurate:
+ * value(x, y) = base + dx * (x - origin_x) + dy * (y - origin_y)
+ */
+struct AttributePlane {
+    float base, dx, dy;
+    int origin_x, origin_y;
+
+    /*
+     * Returns the value at the start of a row (x = origin_x).
+     */
+    float RowStart(int y) const
+    {
+        return this->base + this->dy * float(y - this->origin_y);
+    }
+
+    /*
+     * Returns the value at pixel x of a row that starts with row_start.
+     */
+    float AlongRow(float row_start, int x) const
+    {
+        return row_start + this->dx * float(x - this->origin_x);
+    }
+};
+
+/*
+ * Inclusive rectangle of pixels in buffer space.
+ */
+struct ScreenRect {
+    int min_x, min_y, max_x, max_y;
+};
+
+/*
+ * How the pixels covered by a triangle are shaded.
+ */
+enum class RasterMode {
+    FLAT,       // Every pixel is the same color
+    GRADIENT,   // The color is scaled by an interpolated intensity [0, 1]
+    DEPTH,      // Flat color, but only pixels closer than the depth buffer (interpolated 1/z) are drawn
+    VISIBILITY  // Depth tested like DEPTH, but writes a triangle ID (packed_color) to the visibility buffer instead
+};
+
+/*
+ * Everything the rasterizer needs to know about one triangle, computed once per triangle.
+ */
+struct TriangleSetup {
+    EdgeFunction edges[3];  // Edge i is opposite vertex i (with the fill rule bias in c)
+    int64_t double_area;    // Twice the area of the triangle (the value of edge i at vertex i)
+    int vertex_x, vertex_y; // Vertex 0 in buffer space, in sub-pixel units
+    int origin_x, origin_y; // The pixel nearest to vertex 0
+    ScreenRect bounds;      // Bounding box of the triangle, clipped to the screen
+    AttributePlane attribute;   // Gradient intensity (GRADIENT) or 1/z (DEPTH)
+    RasterMode mode;
+    Color color;            // Base color for GRADIENT
+    uint32_t packed_color;  // Packed color for FLAT and DEPTH, or the triangle ID for VISIBILITY
+};
+
+
+#endif
@@ -13,6 +13,9 @@
  */
 #ifndef _GRAPHICS_SCENE_H
 #define _GRAPHICS_SCENE_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 
 
@@ -23,6 +26,11 @@
  * 
  * Transform objects can easily be type-cast to a 4x4 matrix ready for matrix multiplication, in
  * the form of a TransformMatrix.
+ *
+ * The matrix is cached: it is only built again when scale, rotation, or translation have
+ * changed since the last time it was asked for, so transforms that do not move cost nothing.
+ * (The values are public, so the transform keeps a copy of the ones its matrix was built from
+ * and compares them, instead of relying on setters.)
  */
 class Transform {
     // Member variables
@@ -31,6 +39,11 @@ class Transform {
         float rotation[3];
         float translation[3];
 
+    private:
+        mutable TransformMatrix matrix;     // The matrix from the last time it was built
+        mutable float matrix_values[9];     // The scale, rotation, and translation the matrix was built from
+        mutable bool matrix_ready;          // False until the matrix is built for the first time
+
     // Constructors
     public:
         /*
@@ -56,6 +69,7 @@ class Transform {
             translation[0] = tx;
             translation[1] = ty;
             translation[2] = tz;
+            matrix_ready = false;
         }
 
         /*
@@ -72,6 +86,14 @@ class Transform {
             translation[0] = to_copy.translation[0];
             translation[1] = to_copy.translation[1];
             translation[2] = to_copy.translation[2];
+
+            // The cached matrix is still good for the copied values
+            matrix_ready = to_copy.matrix_ready;
+            if (matrix_ready)
+            {
+                matrix = to_copy.matrix;
+                std::copy(to_copy.matrix_values, to_copy.matrix_values + 9, matrix_values);
+            }
         }
 
     // Operators
@@ -81,6 +103,13 @@ class Transform {
         */
         operator TransformMatrix() const;
 
+        /*
+         * Returns the transform's 4x4 matrix without copying it, building it again first if any
+         * of the values have changed. The reference is good until the values change.
+         * Not safe to call on the same Transform from more than one thread at a time.
+         */
+        const TransformMatrix& GetMatrix() const;
+
 
     // Methods
     public: 
@@ -91,6 +120,13 @@ class Transform {
         void MoveLocally(float deltaX, float deltaY, float deltaZ);
 
         // void RotateAboutAxis(HomCoordinates axis_vector, float rotation);
+
+    // Private helper methods
+    private:
+        /*
+         * Builds the matrix from scratch: translation * rotation * scale.
+         */
+        TransformMatrix BuildMatrix() const;
 };
 
 
@@ -106,10 +142,79 @@ struct Triangle {
 /*
  * The Model struct contains a list of vertices (Points in Model Space)
  * and a list of triangles (containing the indices of the points to link together).
+ *
+ * The render pipeline reads a copy of the vertices (the vertex stream) and a bounding sphere
+ * fitted around them. Both are rebuilt the next time they are needed after the vertices change,
+ * as long as the change goes through SetVertex() or EditVertices(). Code that writes to
+ * `vertices` directly must call UpdateVertexStream() afterwards, or the model keeps rendering
+ * (and culling) its old shape.
  */
 struct Model {
     std::vector<Point3D> vertices;
     std::vector<Triangle> triangles;
+    VertexStream vertex_stream;     // The vertices as separate x, y, z arrays for the render pipeline
+    HomCoordinates bounding_sphere_center;  // Center of a sphere around every vertex (model space)
+    float bounding_sphere_radius = 0;       // Radius of that sphere
+    bool vertices_changed = true;           // True when the vertex stream and sphere are out of date
+
+    /*
+     * Moves one vertex, and marks the vertex stream and bounding sphere out of date.
+     * @param index (int) the index of the vertex to move
+     * @param point (Point3D) the new position of the vertex, in model space
+     */
+    void SetVertex(int index, const Point3D& point)
+    {
+        this->vertices[index] = point;
+        this->vertices_changed = true;
+    }
+
+    /*
+     * Returns the vertices for editing in place, and marks the vertex stream and bounding sphere
+     * out of date. Take the reference again for each batch of edits; the stream is rebuilt on the
+     * next call to GetVertexStream().
+     */
+    std::vector<Point3D>& EditVertices()
+    {
+        this->vertices_changed = true;
+        return this->vertices;
+    }
+
+    /*
+     * Returns the vertices as a VertexStream. The stream and bounding sphere are worked out the
+     * first time, and again after SetVertex(), EditVertices(), or a change in the number of vertices.
+     */
+    const VertexStream& GetVertexStream()
+    {
+        if (this->vertices_changed || this->vertex_stream.Size() != int(this->vertices.size()))
+        {
+            this->UpdateVertexStream();
+        }
+        return this->vertex_stream;
+    }
+
+    /*
+     * Returns the center of the model's bounding sphere, in model space.
+     */
+    HomCoordinates GetBoundingSphereCenter()
+    {
+        this->GetVertexStream();
+        return this->bounding_sphere_center;
+    }
+
+    /*
+     * Returns the radius of the model's bounding sphere, in model space.
+     */
+    float GetBoundingSphereRadius()
+    {
+        this->GetVertexStream();
+        return this->bounding_sphere_radius;
+    }
+
+    /*
+     * Copies the vertices into the vertex stream and fits the bounding sphere around them.
+     * Call this after writing to `vertices` directly.
+     */
+    void UpdateVertexStream();
 };
 
 /*
@@ -122,6 +227,7 @@ class ModelInstance {
 
         struct Model * model;
         Transform transform;
+        bool depth_sorted;  // True if the scene may draw this instance in front-to-back order
 
     // Constructors
     public:
@@ -132,6 +238,7 @@ class ModelInstance {
         {
             this->model = nullptr;
             this->transform = Transform();
+            this->depth_sorted = true;
         }
         /*
          * Constructs a model instance with a model pointer and a transform.
@@ -140,6 +247,7 @@ class ModelInstance {
         {
             this->model = model;
             this->transform = transform;
+            this->depth_sorted = true;
         }
 
         /*
@@ -149,6 +257,7 @@ class ModelInstance {
         {
             this->model = to_copy.model;
             this->transform = Transform(to_copy.transform); // Creates a copy of the transform
+            this->depth_sorted = to_copy.depth_sorted;
         }
 
         // ~ModelInstance();
@@ -168,37 +277,83 @@ class ModelInstance {
             return &(this->transform);
         }
 
+        /*
+         * Sets whether the scene sorts this instance with the others, nearest first (the default).
+         * Instances that are not depth sorted are drawn after all of the sorted ones, in the
+         * order they were added to the scene (for example, to draw something last).
+         */
+        void SetDepthSorted(bool depth_sorted)
+        {
+            this->depth_sorted = depth_sorted;
+        }
+
+        bool GetDepthSorted()
+        {
+            return this->depth_sorted;
+        }
+
+        /*
+         * Returns the radius of the model's bounding sphere after this instance's transform.
+         * Rotations and translations keep distances, so only the largest scale can grow the sphere.
+         */
+        float GetScaledBoundingSphereRadius()
+        {
+            float largest_scale = std::max(std::fabs(this->transform.scale[0]),
+                std::max(std::fabs(this->transform.scale[1]), std::fabs(this->transform.scale[2])));
+            return this->model->GetBoundingSphereRadius() * largest_scale;
+        }
+
 
 };
 
 /*
  * RenderableModelInstance is a heavier-weight version of the ModelInstance
  * that calculates and stores the points/triangles to be used in the render pipeline.
- * This object should be destroyed as soon as it is no longer in use.
+ * Scenes keep one per model instance and Reset() it every frame, so its lists keep their capacity.
  * 
- * .GenerateWorldspacePoints() - apply transform to the model
- * .ApplyTransform( camera_matrix ) - move points to camera space
- * .GenerateBoundingSphere() - generate the bounding sphere
+ * .GenerateCameraspacePoints( camera_matrix * transform_matrix ) - move the model straight to camera space
+ *      (or .GenerateWorldspacePoints() and then .ApplyTransform( camera_matrix ), in two steps)
+ *      Either way, the model's bounding sphere is moved along with the points.
  * 
  * Check if bounding sphere is in bounds, or reject the model with .Reject()
- * Clip against plane if there is an intersection with .ClipTrianglesAgainstPlane( Plane* )
+ * Clip against the planes the sphere crosses with .ClipTrianglesAgainstPlanes( planes, count )
  */
 class RenderableModelInstance: public ModelInstance {
     friend class Scene;
+
+    // Constants
+    public:
+        static constexpr int max_clip_planes = 7;           // Outcodes have one bit per plane...
+        static constexpr uint8_t untested_outcode = 0x80;   // ...and the top bit marks points that have not been tested yet
+
+    // Types
+    private:
+        /*
+         * An edge that was cut by a clipping plane: the points at its ends (lowest index first),
+         * the plane, and the point made where the plane crosses it (-1 if the entry is empty).
+         */
+        struct CutEdge {
+            int low, high;
+            int plane;
+            int crossing;
+        };
     
     // Member variables
     private:
-        std::vector<HomCoordinates> points; // List of 3D points (worldspace, modelspace, or cameraspace)
+        VertexStream points;    // List of 3D points (worldspace, modelspace, or cameraspace)
+        VertexStream world_points;  // The model's points in world space, only filled in by GetWorldspacePoints()
+        bool world_points_ready;    // True if world_points is up to date with the model and transform
         std::vector<Triangle> triangles;    // List of triangles for rendering
         bool is_rejected;   // True if the instance should not be rendered (all points are outside of a plane)
         HomCoordinates bounding_sphere_center;  // The center of a sphere including all points
         float bounding_sphere_radius;           // The radius of a sphere including all points
 
         // These following variables are used as buffers for clipping triangles
-        
-        std::vector<Triangle> new_tris; // List of new triangles to add to this render instance
-        std::vector<HomCoordinates> new_points; // List of new points to add to this render instance, for the new triangles
-        int new_point_start_index; // Index to start building new triangles
+
+        std::vector<Triangle> clipped_tris; // The clipped triangles, swapped with the triangle list when clipping is done
+        std::vector<uint8_t> outcodes;      // For every point, one bit per clipping plane, set if the point is outside that plane
+        std::vector<CutEdge> cut_edges;     // Hash table of the edges cut so far, so triangles sharing an edge share its new point
+        int cut_edge_count;                 // Number of entries in use in cut_edges
 
         // Debugging boolean
         bool in_camera_space = false;
@@ -212,13 +367,14 @@ class RenderableModelInstance: public ModelInstance {
         RenderableModelInstance(): ModelInstance()
         {
             this->is_rejected = true;
-            this->points.clear();
+            this->points.Clear();
+            this->world_points_ready = false;
             this->triangles.clear();
             this->bounding_sphere_center = HomCoordinates();
             this->bounding_sphere_radius = 0;
-            this->new_tris.clear();
-            this->new_points.clear();
-            this->new_point_start_index = 0;
+            this->clipped_tris.clear();
+            this->outcodes.clear();
+            this->cut_edge_count = 0;
         }
 
         /*
@@ -230,14 +386,15 @@ class RenderableModelInstance: public ModelInstance {
             // Set this instance to be rendered with its list of triangles
             this->is_rejected = false;  
             this->triangles = this->model->triangles;
-            this->new_point_start_index = this->triangles.size();
 
 
-            this->points.clear();
+            this->points.Clear();
+            this->world_points_ready = false;
             this->bounding_sphere_center = HomCoordinates();
             this->bounding_sphere_radius = 0;
-            this->new_tris.clear();
-            this->new_points.clear();       
+            this->clipped_tris.clear();
+            this->outcodes.clear();
+            this->cut_edge_count = 0;
         }
 
         /*
@@ -248,12 +405,10 @@ class RenderableModelInstance: public ModelInstance {
             this->is_rejected = to_copy.is_rejected;
 
             // Explicitly copy vectors
-            // Points vector
-            this->points.resize(to_copy.points.size());
-            for (int i = 0; i < to_copy.points.size(); ++i)
-            {
-                this->points[i] = to_copy.points[i];
-            }
+            // Points streams
+            this->points = to_copy.points;
+            this->world_points = to_copy.world_points;
+            this->world_points_ready = to_copy.world_points_ready;
 
             // Triangles vector
             this->triangles.resize(to_copy.triangles.size());
@@ -265,18 +420,10 @@ class RenderableModelInstance: public ModelInstance {
             this->bounding_sphere_radius = to_copy.bounding_sphere_radius;
 
             // Copy buffer vectors
-            this->new_tris.resize(to_copy.new_tris.size());
-            for (int i = 0; i < to_copy.new_tris.size(); ++i)
-            {
-                this->new_tris[i] = to_copy.new_tris[i];
-            }
-
-            this->new_points.resize(to_copy.new_points.size());
-            for (int i = 0; i < to_copy.new_points.size(); ++i)
-            {
-                this->new_points[i] = to_copy.new_points[i];
-            }
-            this->new_point_start_index = to_copy.new_point_start_index;
+            this->clipped_tris = to_copy.clipped_tris;
+            this->outcodes = to_copy.outcodes;
+            this->cut_edges = to_copy.cut_edges;
+            this->cut_edge_count = to_copy.cut_edge_count;
 
 
             this->in_camera_space = to_copy.in_camera_space;
@@ -287,6 +434,28 @@ class RenderableModelInstance: public ModelInstance {
 
     // Methods
     public:
+        /*
+         * Points this instance at a ModelInstance and copies the model's triangles, like the
+         * ModelInstance constructor, but keeps the memory of every list for reuse.
+         * This instance has a list of model triangles, but no points.
+         */
+        void Reset(ModelInstance * instance)
+        {
+            // Bring the instance's own matrix up to date first, so the copy made here carries it
+            // along and the matrix stays cached from frame to frame
+            instance->GetTransform()->GetMatrix();
+            ModelInstance::operator=(*instance);
+            this->is_rejected = false;
+            this->triangles.assign(this->model->triangles.begin(), this->model->triangles.end());
+
+            this->points.Clear();
+            this->world_points_ready = false;
+            this->bounding_sphere_center = HomCoordinates();
+            this->bounding_sphere_radius = 0;
+            this->clipped_tris.clear();
+            this->in_camera_space = false;
+        }
+
         /*
          * Uses the model pointer and transform to create a list of points in worldspace.
          * This overwrites the points list to use the original model (undoes clipping).
@@ -294,14 +463,32 @@ class RenderableModelInstance: public ModelInstance {
         void GenerateWorldspacePoints();
 
         /*
-         * Applies a TransformMatrix to every point in this model's list.
+         * Applies a TransformMatrix to every point in this model's list, and moves the bounding
+         * sphere's center with them. The matrix must not scale (like a camera's matrix).
          */
         void ApplyTransform(TransformMatrix transform);
 
+        /*
+         * Creates the list of points in camera space straight from the model, with one matrix
+         * (world_to_camera * the instance transform), so every point is only transformed once.
+         * This overwrites the points list to use the original model (undoes clipping), and places
+         * the model's bounding sphere in camera space. The camera's part of the matrix must not
+         * scale (a camera's matrix only rotates and moves).
+         *
+         * @param model_to_camera - the camera's matrix times this instance's transform matrix
+         */
+        void GenerateCameraspacePoints(const TransformMatrix& model_to_camera);
+
+        /*
+         * Returns the model's points in world space (not clipped). They are only worked out the
+         * first time they are asked for after the instance is Reset().
+         */
+        const VertexStream& GetWorldspacePoints();
+
         /*
          * Returns a pointer to this instance's list of coordinates.
          */
-        std::vector<HomCoordinates> * GetPoints()
+        VertexStream * GetPoints()
         {
             return &(this->points);
         }
@@ -314,11 +501,6 @@ class RenderableModelInstance: public ModelInstance {
             return &(this->triangles);
         }
 
-        /*
-         * Based on the current list of points, generate a bounding sphere to contain the model's points.
-         */
-        void GenerateBoundingSphere();
-
         /*
          * Sets this model's rejected value to true.
          */
@@ -327,10 +509,25 @@ class RenderableModelInstance: public ModelInstance {
             this->is_rejected = true;
         }
 
+        /*
+         * Clips this instance's triangles against several planes at once, keeping the parts on
+         * the positive side of every plane. Each point is tested against the planes once (its
+         * outcode); triangles with every corner inside are kept as they are, triangles with every
+         * corner outside the same plane are dropped, and only the rest are clipped, as a polygon,
+         * against the planes they cross. New points are added to the end of the point list, one
+         * for every edge a plane cuts (triangles sharing the edge share the point).
+         *
+         * @param planes - the planes to clip against (at most max_clip_planes, which is asserted)
+         */
+        void ClipTrianglesAgainstPlanes(Plane * const planes[], int plane_count);
+
         /*
          * Clips this instance's points and triangles against a plane.
          */
-        void ClipTrianglesAgainstPlane(Plane * plane);
+        void ClipTrianglesAgainstPlane(Plane * plane)
+        {
+            this->ClipTrianglesAgainstPlanes(&plane, 1);
+        }
 
         // Getters
         float GetBoundingSphereRadius()
@@ -353,9 +550,56 @@ class RenderableModelInstance: public ModelInstance {
 
     private:
         /*
-         * Clips a triangle against a plane.
+         * Clips a triangle that crosses some of the planes (Sutherland-Hodgman, one plane at a
+         * time) and adds the pieces of the remaining polygon to clipped_tris.
+         *
+         * @param crossed - the outcode bits of the planes the triangle's corners are outside of
+         */
+        void ClipTriangle(const Triangle& to_clip, uint8_t crossed, Plane * const planes[], int plane_count);
+
+        /*
+         * Returns a point's outcode: one bit per plane, set if the point is outside of that plane.
+         * The point is only tested the first time its outcode is asked for.
+         */
+        uint8_t GetOutcode(int index, Plane * const planes[], int plane_count)
+        {
+            uint8_t& outcode = this->outcodes[index];
+            if (outcode == untested_outcode)
+            {
+                HomCoordinates point = this->points.Get(index);
+                outcode = 0;
+                for (int i = 0; i < plane_count; ++i)
+                {
+                    if (planes[i]->SignedDistance(point) < 0)
+                    {
+                        outcode |= uint8_t(1 << i);
+                    }
+                }
+            }
+            return outcode;
+        }
+
+        /*
+         * Returns the index of the point where a plane cuts the edge between an inside and an
+         * outside point. The point is only made (and added to the point list) the first time
+         * the edge is cut by that plane.
+         *
+         * @param plane_index - the plane's position in the list passed to ClipTrianglesAgainstPlanes()
+         */
+        int CutEdgeAt(int inside_index, int outside_index, Plane * plane, int plane_index);
+
+        /*
+         * Returns where an edge is in the cut_edges table, or the empty entry where it would go.
+         * The edge's points must be given lowest index first.
          */
-        bool ClipTriangle(Triangle to_clip, Plane * plane);
+        size_t FindCutEdge(int low, int high, int plane_index) const;
+
+        /*
+         * Moves the model's bounding sphere with a matrix made of the instance transform and
+         * (optionally) a rotation and translation: the center is transformed, and the radius is
+         * multiplied by the largest scale.
+         */
+        void PlaceBoundingSphere(const TransformMatrix& matrix);
     
 };
 
@@ -438,6 +682,14 @@ class Camera
             this->GenerateClippingPlanes();
         }
 
+        /*
+         * Returns the distance from the camera to the viewport, which is also the near clipping plane.
+         */
+        float GetViewportDistance()
+        {
+            return this->viewport_distance;
+        }
+
         /*
          * Changes the camera's viewport dimensions and regenerates the clipping planes accordingly.
          * @param width, height (float) - the dimensions (in world space units) of the camera's viewport
@@ -467,6 +719,20 @@ class Camera
         Point2D ProjectVertex(Point3D vertex);
         Point2D ProjectVertex(HomCoordinates vertex);
 
+        /*
+         * Same as ProjectVertex, but keeps 4 bits of sub-pixel precision (28.4 fixed point)
+         * instead of truncating to whole pixels. The rasterizer uses this so that triangle
+         * edges move smoothly with the camera instead of snapping from pixel to pixel.
+         */
+        SubPixelPoint ProjectVertexSubPixel(HomCoordinates vertex);
+
+        /*
+         * Projects every point of a VertexStream (in camera space) like ProjectVertexSubPixel.
+         *
+         * @param projected - room for points.Size() projected points
+         */
+        void ProjectVertexStream(const VertexStream& points, SubPixelPoint* projected);
+
 
         /*
          * Sets the position of the camera in world space. Overwrites the previous position.
@@ -522,9 +788,24 @@ class GraphicsManager;
  */
 class Scene
 {
+    // Private types
+    private:
+        /*
+         * A clipped instance waiting to be drawn this frame.
+         */
+        struct QueuedInstance {
+            RenderableModelInstance* instance;
+            float distance;     // Distance from the camera to the nearest point of the bounding sphere
+            int order;          // Position in model_instances, for instances that are not depth sorted and for ties
+            bool depth_sorted;
+            uint32_t first_id;  // Visibility buffer ID of the instance's first triangle (DEFERRED shading)
+        };
+
     // Private member variables
     private:
         std::vector<ModelInstance*> model_instances;  // List of models to render
+        std::vector<QueuedInstance> draw_queue;     // Instances to draw this frame (kept between frames to avoid allocating)
+        std::vector<RenderableModelInstance> render_instances;  // Clipping and drawing space for each model instance, reused every frame
 
         Camera* main_camera;    // Camera to render models from
         GraphicsManager* graphics_manager;  // GraphicsManager to perform draw calls
@@ -571,6 +852,8 @@ class Scene
 
         /*
          * Renders the scene to the window created by the GraphicsManager.
+         * Instances are drawn nearest first, so that the depth test can skip whatever they hide
+         * (see ModelInstance::SetDepthSorted() to opt an instance out).
          */
         void RenderScene();
 
@@ -579,30 +862,46 @@ class Scene
         /*
          * Render an individual RenderableModelInstance to the screen
          * based on its current list of points and triangles.
+         *
+         * @param first_id - with DEFERRED shading, the visibility buffer ID of the first triangle
+         *      (the others follow in order); ignored otherwise
          */
-        void RenderInstance(RenderableModelInstance * to_render);
+        void RenderInstance(RenderableModelInstance * to_render, uint32_t first_id);
 
         /*
          * Based on a list of projected vertices, render an individual triangle to the screen.
          *
          * @param triangle (Triangle) the triangle (list of point indices + color) to render
-         * @param projected_vertices (Point2D[]) the 2D projections of the model's points, referenced by the triangle
-         * @param cameraspace_points (std::vector<HomCoordinates>*) pointer to the list of points before projection, for use in the depth buffer
+         * @param projected_vertices (SubPixelPoint[]) the 2D projections of the model's points, referenced by the triangle
+         * @param cameraspace_points (const VertexStream&) the list of points before projection, for use in the depth buffer
+         * @param id (uint32_t) the triangle's visibility buffer ID, with DEFERRED shading
+         */
+        void RenderTriangle(Triangle triangle, SubPixelPoint projected_vertices[], const VertexStream& cameraspace_points, uint32_t id);
+
+        /*
+         * With DEFERRED shading, colors every pixel of the frame buffer from the triangle
+         * that the visibility buffer says is visible there.
          */
-        void RenderTriangle(Triangle triangle, Point2D projected_vertices[], std::vector<HomCoordinates>* cameraspace_points);
+        void ShadeVisibleTriangles();
 
     // Static helper methods
     private:
         /*
          * Given 5 clipping planes, clip a model instance so that 
          * we do not draw points outside of the viewport.
+         * The instance's bounding sphere decides which planes it needs to be clipped against,
+         * and its triangles are then clipped against all of those planes in one pass.
          */
         static void ClipInstance(RenderableModelInstance & instance, std::array<Plane*, 5> planes);
 
         /*
-         * Clip an isntance against a sigle plane, so that none of its points are outside the plane.
+         * Tests a model instance's bounding sphere against the clipping planes before any of its
+         * points are transformed. Returns false if the sphere is entirely outside of any plane
+         * (the same test ClipInstance uses to reject an instance).
+         *
+         * @param model_to_camera - the camera matrix times the instance's transform matrix
          */
-        static void ClipInstanceAgainstPlane(RenderableModelInstance & instance, Plane* plane);       
+        static bool IsInstanceInView(ModelInstance & instance, const TransformMatrix& model_to_camera, std::array<Plane*, 5> planes);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,156 @@
+/* graphics_scratch.h
+ *
+ * Reusable scratch memory for drawing primitives.
+ *
+ * Drawing a model needs temporary arrays whose size depends on the model (its projected
+ * points). Instead of putting them on the stack, where a huge model can overflow it, the
+ * GraphicsManager has a ScratchArena. A primitive takes a Mark() of the arena, carves its
+ * arrays out with Allocate(), and gives them all back with Rewind(mark) when it is done.
+ * Marks nest, so a primitive can draw other primitives.
+ *
+ * The arena keeps its memory between frames. If the arrays do not fit, an extra block is
+ * allocated, and once the arena is empty again the blocks are merged into one that is big
+ * enough. After the first few frames, drawing does not allocate at all.
+ *
+ * @author Alex Wills
+ * @date May 18, 2023
+ */
+#ifndef _GRAPHICS_SCRATCH_H
+#define _GRAPHICS_SCRATCH_H
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/*
+ * Bump allocator for short-lived arrays of plain data (floats, points, ints).
+ * Nothing is constructed or destroyed, so only use it for trivial types.
+ */
+class ScratchArena {
+
+    // Constants
+    public:
+        // Every array starts on a multiple of this many bytes, which suits SSE and AVX loads
+        static constexpr size_t alignment = 32;
+
+        /*
+         * A point to rewind the arena back to.
+         */
+        struct Marker {
+            size_t used;
+            size_t blocks;
+        };
+
+    // Member variables
+    private:
+        std::unique_ptr<unsigned char[]> memory;   // The main block
+        size_t capacity;                            // Size of the main block in bytes
+        size_t used;                                // Bytes handed out from the main block
+
+        std::vector<std::unique_ptr<unsigned char[]>> overflow;    // Extra blocks, freed by Rewind()
+        size_t overflow_bytes;                      // Total size of the extra blocks since the arena was last empty
+
+    // Constructors
+    public:
+        /*
+         * Default constructor. Creates an empty arena.
+         */
+        ScratchArena()
+        {
+            this->capacity = 0;
+            this->used = 0;
+            this->overflow_bytes = 0;
+        }
+
+    // Methods
+    public:
+        /*
+         * Makes sure the arena holds at least a number of bytes without needing extra blocks.
+         * Does nothing while any arrays are allocated.
+         */
+        void Reserve(size_t bytes)
+        {
+            if (bytes > this->capacity && this->used == 0 && this->overflow.empty())
+            {
+                // One extra alignment, because new[] only promises alignof(std::max_align_t)
+                this->memory.reset(new unsigned char[bytes + alignment]);
+                this->capacity = bytes;
+            }
+        }
+
+        /*
+         * Returns room for count values of type T, valid until the arena is rewound past it.
+         * The values are not initialized.
+         */
+        template <typename T>
+        T* Allocate(size_t count)
+        {
+            size_t bytes = (count * sizeof(T) + alignment - 1) / alignment * alignment;
+
+            if (this->used + bytes <= this->capacity)
+            {
+                T* result = reinterpret_cast<T*>(this->AlignedStart(this->memory.get()) + this->used);
+                this->used += bytes;
+                return result;
+            }
+
+            // Out of room: use a block of its own until the arena is empty and the blocks are merged
+            this->overflow.push_back(std::unique_ptr<unsigned char[]>(new unsigned char[bytes + alignment]));
+            this->overflow_bytes += bytes;
+            return reinterpret_cast<T*>(this->AlignedStart(this->overflow.back().get()));
+        }
+
+        /*
+         * Returns the current position of the arena, to Rewind() to later.
+         */
+        Marker Mark() const
+        {
+            return Marker{this->used, this->overflow.size()};
+        }
+
+        /*
+         * Releases every array allocated since a Mark() was taken.
+         */
+        void Rewind(Marker mark)
+        {
+            this->overflow.resize(mark.blocks);
+            if (mark.used == 0 && mark.blocks == 0 && this->overflow_bytes > 0)
+            {
+                // The arena is empty: grow the main block so the same work fits in it next time
+                size_t needed = this->capacity + this->overflow_bytes;
+                this->overflow_bytes = 0;
+                this->used = 0;
+                this->Reserve(needed);
+            }
+            this->used = mark.used;
+        }
+
+        /*
+         * Releases every array in the arena.
+         */
+        void Reset()
+        {
+            this->Rewind(Marker{0, 0});
+        }
+
+        /*
+         * Returns the size of the main block in bytes.
+         */
+        size_t GetCapacity() const
+        {
+            return this->capacity;
+        }
+
+    // Private helper methods
+    private:
+        /*
+         * Rounds a block's address up to the arena alignment.
+         */
+        static unsigned char* AlignedStart(unsigned char* block)
+        {
+            size_t address = reinterpret_cast<size_t>(block);
+            return block + (alignment - address % alignment) % alignment;
+        }
+};
+
+
+#endif
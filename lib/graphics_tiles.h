@@ -0,0 +1,189 @@
+/* graphics_tiles.h
+ *
+ * Multi-threaded, tile binned (sort-middle) rasterization.
+ *
+ * While a triangle batch is open (GraphicsManager::BeginTriangleBatch()), depth tested
+ * triangles are set up on the calling thread and sorted into the screen tiles that their
+ * bounding boxes touch. When the batch ends, a pool of worker threads rasterizes the tiles
+ * in parallel. Each tile only touches its own pixels in the FrameBuffer and DepthBuffer,
+ * and draws its triangles in the order they were submitted, so the output is identical
+ * to drawing the triangles one at a time on a single thread.
+ *
+ * @author Alex Wills
+ * @date May 16, 2023
+ */
+#ifndef _GRAPHICS_TILES_H
+#define _GRAPHICS_TILES_H
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "graphics_raster.h"
+
+/*
+ * Fixed set of worker threads that split up a list of tasks.
+ * The thread that calls Run() works on tasks too, so a pool with a thread count
+ * of 1 has no worker threads and runs everything on the caller.
+ */
+class RenderThreadPool {
+
+    // Member variables
+    private:
+        std::vector<std::thread> workers;
+        std::mutex pool_mutex;
+        std::condition_variable work_ready;     // Signals workers that a new job has started (or the pool is stopping)
+        std::condition_variable work_done;      // Signals Run() that every worker has finished the job
+
+        std::function<void(int, int)> job;      // job(task, thread_index)
+        int num_tasks;
+        std::atomic<int> next_task;
+        int busy_workers;
+        unsigned int job_number;                // Incremented for every job so workers can tell jobs apart
+        bool stopping;
+
+    // Constructors
+    public:
+        /*
+         * Default constructor. Creates a pool that runs everything on the calling thread.
+         */
+        RenderThreadPool()
+        {
+            this->num_tasks = 0;
+            this->next_task = 0;
+            this->busy_workers = 0;
+            this->job_number = 0;
+            this->stopping = false;
+        }
+
+        /*
+         * Destructor. Stops and joins the worker threads.
+         */
+        ~RenderThreadPool()
+        {
+            this->SetThreadCount(1);
+        }
+
+        // Threads cannot be copied
+        RenderThreadPool(const RenderThreadPool&) = delete;
+        RenderThreadPool& operator=(const RenderThreadPool&) = delete;
+
+    // Methods
+    public:
+        /*
+         * Changes the number of threads (including the caller of Run()) that work on jobs.
+         */
+        void SetThreadCount(int thread_count);
+
+        /*
+         * Returns the number of threads (including the caller of Run()) that work on jobs.
+         */
+        int GetThreadCount() const
+        {
+            return this->workers.size() + 1;
+        }
+
+        /*
+         * Calls job(task, thread_index) for every task in [0, num_tasks), spread across the
+         * threads, and returns once every task is finished. thread_index is in [0, GetThreadCount()),
+         * and 0 is the calling thread.
+         */
+        void Run(int num_tasks, const std::function<void(int, int)>& job);
+
+    // Private helper methods
+    private:
+        /*
+         * Takes tasks from the current job until there are none left.
+         */
+        void WorkOnTasks(int thread_index);
+
+        /*
+         * Loop run by each worker thread. last_job is the job number when the thread started.
+         */
+        void WorkerLoop(int thread_index, unsigned int last_job);
+};
+
+/*
+ * Sorts set up triangles into square screen tiles.
+ * The lists keep their memory between frames, so binning does not allocate once warmed up.
+ */
+class TileBinner {
+
+    // Constants
+    public:
+        // Width and height of a tile in pixels. This is a multiple of FrameBuffer::row_alignment,
+        // so SIMD blocks never cross from one tile into another.
+        static constexpr int tile_size = 64;
+
+    // Member variables
+    private:
+        int canvas_width, canvas_height;
+        int tiles_x, tiles_y;
+        std::vector<TriangleSetup> triangles;   // Every triangle in the batch, in submission order
+        std::vector<std::vector<int>> bins;     // For each tile, indices into triangles (in submission order)
+
+    // Constructors
+    public:
+        /*
+         * Default constructor. Creates a binner with no tiles.
+         */
+        TileBinner()
+        {
+            this->canvas_width = 0;
+            this->canvas_height = 0;
+            this->tiles_x = 0;
+            this->tiles_y = 0;
+        }
+
+    // Methods
+    public:
+        /*
+         * Sets the size of the canvas to split into tiles, and empties every tile.
+         */
+        void Resize(int canvas_width, int canvas_height);
+
+        /*
+         * Empties every tile, keeping the memory for the next batch.
+         */
+        void Clear();
+
+        /*
+         * Adds a set up triangle to every tile that its bounding box touches.
+         */
+        void AddTriangle(const TriangleSetup& setup);
+
+        /*
+         * Returns true if no triangles have been added since the last Clear().
+         */
+        bool IsEmpty() const
+        {
+            return this->triangles.empty();
+        }
+
+        int GetTileCount() const
+        {
+            return this->tiles_x * this->tiles_y;
+        }
+
+        /*
+         * Returns the pixels covered by a tile, in buffer space.
+         */
+        ScreenRect GetTileRect(int tile) const;
+
+        /*
+         * Returns the list of triangle indices in a tile.
+         */
+        const std::vector<int>& GetBin(int tile) const
+        {
+            return this->bins[tile];
+        }
+
+        const TriangleSetup& GetTriangle(int index) const
+        {
+            return this->triangles[index];
+        }
+};
+
+
+#endif
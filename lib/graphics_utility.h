@@ -17,6 +17,26 @@ struct Point2D {
 	int x, y;
 };
 
+/*
+ * Point on the canvas with sub-pixel precision, stored in 28.4 fixed point:
+ * the low SUBPIXEL_BITS bits of x and y are sixteenths of a pixel.
+ * (0, 0) is the center of the screen and y is positive upwards, like Point2D.
+ */
+struct SubPixelPoint {
+	int x, y;
+};
+
+static constexpr int SUBPIXEL_BITS = 4;
+static constexpr int SUBPIXEL_SCALE = 1 << SUBPIXEL_BITS;	// Sub-pixel steps in one pixel
+
+/*
+ * Converts a whole pixel point to sub-pixel precision.
+ */
+inline SubPixelPoint ToSubPixel(Point2D point)
+{
+	return SubPixelPoint{point.x * SUBPIXEL_SCALE, point.y * SUBPIXEL_SCALE};
+}
+
 struct Point3D {
 	float x, y, z;
 };
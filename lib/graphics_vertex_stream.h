@@ -0,0 +1,217 @@
+/* graphics_vertex_stream.h
+ *
+ * Structure-of-arrays storage for the points of a model.
+ *
+ * A list of HomCoordinates keeps x, y, z, and w of each point together, so a loop that
+ * transforms every point has to pull the coordinates apart before it can use SIMD. A
+ * VertexStream keeps all of the x values in one array, all of the y values in another, and all
+ * of the z values in a third. The arrays are aligned and padded to a multiple of 8 floats (one
+ * AVX register), so loops over them can run over whole registers without a scalar tail, and
+ * the compiler can vectorize the projection loop. Transforming a stream by a matrix has its
+ * own SIMD kernel in graphics_vertex_stream.cpp.
+ *
+ * Points in the render pipeline always have w = 1 (models are built from Point3Ds, transforms
+ * are affine, and clipping interpolates between points), so w is not stored.
+ *
+ * Needs graphics_math.h to be included first (graphics.h includes them in order).
+ *
+ * @author Alex Wills
+ * @date May 25, 2023
+ */
+#ifndef _GRAPHICS_VERTEX_STREAM_H
+#define _GRAPHICS_VERTEX_STREAM_H
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+
+/*
+ * A growable list of 3D points stored as separate x, y, and z arrays.
+ * Every float in the padded arrays holds a finite value (unused ones are 0), so SIMD loops
+ * may read and write the whole padded range.
+ */
+class VertexStream {
+
+    // Constants
+    public:
+        static constexpr int lane_count = 8;        // The arrays are padded to a multiple of this many floats
+        static constexpr size_t alignment = 32;     // Every array starts on a multiple of this many bytes
+
+    // Member variables
+    private:
+        std::unique_ptr<float[]> memory;    // One block holding the three arrays
+        float* x;
+        float* y;
+        float* z;
+        int count;      // Number of points
+        int capacity;   // Floats in each array (a multiple of lane_count)
+
+    // Constructors
+    public:
+        /*
+         * Default constructor. Creates an empty stream.
+         */
+        VertexStream()
+        {
+            this->x = nullptr;
+            this->y = nullptr;
+            this->z = nullptr;
+            this->count = 0;
+            this->capacity = 0;
+        }
+
+        /*
+         * Copy constructor. Explicitly copies the points.
+         */
+        VertexStream(const VertexStream& to_copy) : VertexStream()
+        {
+            *this = to_copy;
+        }
+
+        /*
+         * Copies the points of another stream, reusing this stream's memory if it is big enough.
+         */
+        VertexStream& operator=(const VertexStream& to_copy)
+        {
+            if (this != &to_copy)
+            {
+                this->Resize(to_copy.count);
+                std::copy(to_copy.x, to_copy.x + to_copy.PaddedSize(), this->x);
+                std::copy(to_copy.y, to_copy.y + to_copy.PaddedSize(), this->y);
+                std::copy(to_copy.z, to_copy.z + to_copy.PaddedSize(), this->z);
+            }
+            return *this;
+        }
+
+    // Methods
+    public:
+        /*
+         * Returns the number of points in the stream.
+         */
+        int Size() const
+        {
+            return this->count;
+        }
+
+        /*
+         * Returns the number of points rounded up to a multiple of lane_count. SIMD loops can
+         * run to this size.
+         */
+        int PaddedSize() const
+        {
+            return (this->count + lane_count - 1) / lane_count * lane_count;
+        }
+
+        /*
+         * Removes every point, keeping the memory for reuse.
+         */
+        void Clear()
+        {
+            this->count = 0;
+        }
+
+        /*
+         * Changes the number of points, keeping the memory for reuse. New points are (0, 0, 0)
+         * unless the stream held points there before.
+         */
+        void Resize(int new_count)
+        {
+            this->Reserve(new_count);
+            this->count = new_count;
+        }
+
+        /*
+         * Makes sure the stream can hold a number of points without growing.
+         */
+        void Reserve(int new_capacity)
+        {
+            if (new_capacity <= this->capacity)
+            {
+                return;
+            }
+
+            // Grow by at least half, and keep every array a whole number of registers long
+            new_capacity = std::max(new_capacity, this->capacity + this->capacity / 2);
+            new_capacity = (new_capacity + lane_count - 1) / lane_count * lane_count;
+
+            // One extra alignment, because new[] only promises alignof(std::max_align_t)
+            std::unique_ptr<float[]> new_memory(new float[3 * size_t(new_capacity) + alignment / sizeof(float)]());
+            float* start = AlignedStart(new_memory.get());
+            float* new_x = start;
+            float* new_y = start + new_capacity;
+            float* new_z = start + 2 * size_t(new_capacity);
+            std::copy(this->x, this->x + this->capacity, new_x);
+            std::copy(this->y, this->y + this->capacity, new_y);
+            std::copy(this->z, this->z + this->capacity, new_z);
+
+            this->memory = std::move(new_memory);
+            this->x = new_x;
+            this->y = new_y;
+            this->z = new_z;
+            this->capacity = new_capacity;
+        }
+
+        /*
+         * Returns a point as HomCoordinates (with w = 1). The caller must stay inside the stream.
+         */
+        HomCoordinates Get(int index) const
+        {
+            return HomCoordinates(this->x[index], this->y[index], this->z[index], 1);
+        }
+
+        /*
+         * Overwrites a point (w is ignored). The caller must stay inside the stream.
+         */
+        void Set(int index, const HomCoordinates& point)
+        {
+            this->x[index] = point[0];
+            this->y[index] = point[1];
+            this->z[index] = point[2];
+        }
+        void Set(int index, const Point3D& point)
+        {
+            this->x[index] = point.x;
+            this->y[index] = point.y;
+            this->z[index] = point.z;
+        }
+
+        /*
+         * Adds a point to the end of the stream.
+         */
+        void PushBack(const HomCoordinates& point)
+        {
+            this->Reserve(this->count + 1);
+            this->Set(this->count, point);
+            this->count++;
+        }
+
+        /*
+         * Returns the x, y, or z array. Each holds PaddedSize() floats.
+         */
+        float* X() { return this->x; }
+        float* Y() { return this->y; }
+        float* Z() { return this->z; }
+        const float* X() const { return this->x; }
+        const float* Y() const { return this->y; }
+        const float* Z() const { return this->z; }
+
+        /*
+         * Sets this stream to the points of another stream multiplied by an affine transform
+         * (a matrix whose bottom row is 0, 0, 0, 1). The source may be this stream.
+         * Uses AVX2 or SSE2 when the compiler allows it (see graphics_vertex_stream.cpp).
+         */
+        void TransformFrom(const VertexStream& source, const TransformMatrix& matrix);
+
+    // Private helper methods
+    private:
+        /*
+         * Rounds an address up to the stream alignment.
+         */
+        static float* AlignedStart(float* block)
+        {
+            size_t address = reinterpret_cast<size_t>(block);
+            return block + (alignment - address % alignment) % alignment / sizeof(float);
+        }
+};
+
+
+#endif
@@ -4,12 +4,14 @@
  * Whatever library this program uses, this file should define the 
  * functions to open a window on the user's screen and place a pixel at 
  * a given point.
- * Currently uses SDL2.
+ * Currently uses SDL2. Pixels are placed in a CPU-side FrameBuffer, which is
+ * uploaded to SDL through a streaming texture once per frame.
  * 
  * @author Alex Wills
  * @date March 3, 2023
  */
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <SDL2/SDL.h>
@@ -23,6 +25,7 @@
  */
 void GraphicsManager::OpenWindow(int width, int height)
 {
+	this->is_offscreen = false;
 	SDL_Init(SDL_INIT_VIDEO);
 	//SDL_CreateWindowAndRenderer(width, height, 0, &(this->window), &(this->renderer) );
 
@@ -34,6 +37,38 @@ void GraphicsManager::OpenWindow(int width, int height)
 		std::cout << "!!ERROR: " << SDL_GetError() << std::endl;
 	}
 
+	// Texture that receives the frame buffer every time the screen is refreshed
+	screen_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+	if(screen_texture == NULL)
+	{
+		std::cout << "!!ERROR: " << SDL_GetError() << std::endl;
+	}
+
+	this->InitializeCanvas(width, height);
+}
+
+/*
+ * Set up a canvas in memory without opening a window or initializing SDL
+ *
+ * @param width: the width of the canvas, in pixels
+ * @param height: the height of the canvas, in pixels
+ */
+void GraphicsManager::OpenOffscreen(int width, int height)
+{
+	this->is_offscreen = true;
+	std::cout << "~ Rendering offscreen (no window)" << std::endl;
+
+	this->InitializeCanvas(width, height);
+}
+
+/*
+ * Set up the camera, canvas dimensions, depth buffer, and frame buffer for a canvas
+ *
+ * @param width: the width of the canvas, in pixels
+ * @param height: the height of the canvas, in pixels
+ */
+void GraphicsManager::InitializeCanvas(int width, int height)
+{
 	// Also set viewport dimensions for camera
 	float viewport_distance = 3;
 
@@ -58,8 +93,42 @@ void GraphicsManager::OpenWindow(int width, int height)
 
 
 	// Initialize the depth buffer
-	this->depth_buffer = DepthBuffer(width, height);
+	this->depth_buffer = DepthBuffer(width, height, this->depth_format, this->buffer_layout);
+
+	// Initialize the color buffer (black) and draw with white until told otherwise
+	this->frame_buffer = FrameBuffer(width, height, this->buffer_layout);
+	this->brush_color = FrameBuffer::PackColor(WHITE);
+	if (this->shading_mode == ShadingMode::DEFERRED)
+	{
+		this->visibility_buffer = FrameBuffer(width, height, this->buffer_layout);
+	}
+	this->sample_buffer = SampleBuffer(width, height, this->sample_count);
+
+	// Split the canvas into tiles for multi-threaded rasterization
+	this->tile_binner.Resize(width, height);
+
+	// Room for the projected points of a model of a few thousand vertices. Bigger models grow
+	// the arena the first time they are drawn, and it keeps that size from then on.
+	this->scratch_arena.Reserve(4096 * sizeof(SubPixelPoint));
+
+}
 
+/*
+ * Changes how the frame buffer and depth buffer arrange their pixels in memory.
+ * Both buffers are recreated (and cleared) if the canvas is already open.
+ */
+void GraphicsManager::SetBufferLayout(BufferLayout layout)
+{
+	this->buffer_layout = layout;
+	if (this->canvas_width > 0)
+	{
+		this->frame_buffer = FrameBuffer(this->canvas_width, this->canvas_height, layout);
+		this->depth_buffer = DepthBuffer(this->canvas_width, this->canvas_height, this->depth_format, layout);
+		if (this->shading_mode == ShadingMode::DEFERRED)
+		{
+			this->visibility_buffer = FrameBuffer(this->canvas_width, this->canvas_height, layout);
+		}
+	}
 }
 
 /* 
@@ -67,6 +136,15 @@ void GraphicsManager::OpenWindow(int width, int height)
  */
 void GraphicsManager::CloseWindow()
 {
+	this->StopCapture();
+
+	if (this->is_offscreen)
+	{
+		// There is no window, and SDL was never initialized
+		return;
+	}
+
+	SDL_DestroyTexture(this->screen_texture);
 	SDL_DestroyRenderer(this->renderer);
 	SDL_DestroyWindow(this->window);
 	SDL_Quit();
@@ -77,6 +155,12 @@ void GraphicsManager::CloseWindow()
  */
 void GraphicsManager::StayOpenBlocking()
 {	
+	if (this->is_offscreen)
+	{
+		std::cout << "!!WARNING: There is no window to keep open when rendering offscreen." << std::endl;
+		return;
+	}
+
 	bool running = true;
 	while(running)
 	{
@@ -117,16 +201,19 @@ void GraphicsManager::PutPixel(int x, int y)
 {
 //	std::cout << "Placing pixel at (" << x << ", " << y << ")" << std::endl;
 	
+	int column = this->ScreenColumn(x);
+	int row = this->ScreenRow(y);
+
     // Check input and print out warning if pixel is out of screen
-    if ( x < -(this->max_screen_x) || x > this->max_screen_x
-		|| y < -(this->max_screen_y) || y > this->max_screen_y)
+    if ( column < 0 || column >= this->canvas_width
+		|| row < 0 || row >= this->canvas_height)
     {
         std::cout << "!!WARNING: Attempting to place a pixel outside of the screen: (" << x
             << ", " << y << ")" << std::endl; 
     }
 	else 
 	{
-	    SDL_RenderDrawPoint(renderer, this->max_screen_x + x, this->max_screen_y - y);
+	    this->frame_buffer.GetRow(row)[this->frame_buffer.ColumnOffset(column)] = this->brush_color;
 		this->drawCount++;
 	}
 	// Pixel (0, 0) (top left) == World space (-(width / 2), (width / 2)) 
@@ -143,23 +230,45 @@ void GraphicsManager::PutPixel(int x, int y)
  */
 void GraphicsManager::ChangeBrushColor(int red, int green, int blue, int alpha)
 {
-	SDL_SetRenderDrawColor(renderer, red, green, blue, alpha);
+	this->brush_color = FrameBuffer::PackColor(red, green, blue, alpha);
 }
 
 /*
- * Update the renderer on the user's end
+ * Update the renderer on the user's end by uploading the frame buffer in one texture update.
+ * If frames are being captured, the frame is also queued to be written to disk.
  */
 void GraphicsManager::RefreshScreen()
 {
-	SDL_RenderPresent(renderer);
+	// Average the samples of multisampled pixels, then turn the blocks back into rows
+	// (only the BLOCKED layout does any work there)
+	if (this->sample_buffer.IsActive())
+	{
+		this->ResolveSamples();
+	}
+	this->frame_buffer.Resolve();
+
+	if (this->frame_capture != nullptr)
+	{
+		this->frame_capture->SubmitFrame(this->frame_buffer);
+	}
+
+	if (this->is_offscreen)
+	{
+		// The frame buffer is the final image; there is nothing to present
+		return;
+	}
+
+	SDL_UpdateTexture(this->screen_texture, NULL, this->frame_buffer.GetLinearData(), this->frame_buffer.GetPitch());
+	SDL_RenderCopy(this->renderer, this->screen_texture, NULL, NULL);
+	SDL_RenderPresent(this->renderer);
 }
 
 /*
- * Clear the user's screen
+ * Clear the user's screen by filling the frame buffer with the brush color
  */
 void GraphicsManager::ClearScreen()
 {
-	SDL_RenderClear(renderer);
+	this->frame_buffer.Fill(this->brush_color);
 }
 
 
@@ -0,0 +1,327 @@
+/* graphics_capture.cpp
+ *
+ * Definitions for the FrameCapture sink outlined in graphics_capture.h, and the
+ * GraphicsManager functions that send presented frames to it.
+ *
+ * @author Alex Wills
+ * @date May 4, 2023
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "../lib/graphics.h"
+#include "../lib/graphics_capture.h"
+
+
+FrameCapture::FrameCapture(std::string path, CaptureFormat format, int frame_rate,
+    int queue_size, bool block_when_full)
+{
+    this->path = path;
+    this->format = format;
+    this->frame_rate = frame_rate;
+    this->block_when_full = block_when_full;
+
+    this->width = 0;
+    this->height = 0;
+    this->is_open = false;
+    this->stop_requested = false;
+    this->frames_written = 0;
+    this->frames_dropped = 0;
+    this->write_failed = false;
+
+    // Always keep at least one buffer, or nothing could ever be submitted
+    this->frame_pool.resize(queue_size > 0 ? queue_size : 1);
+}
+
+FrameCapture::~FrameCapture()
+{
+    this->Close();
+}
+
+bool FrameCapture::Open(int width, int height)
+{
+    if (this->is_open)
+    {
+        std::cout << "!!WARNING: Frame capture is already open." << std::endl;
+        return true;
+    }
+
+    this->width = width;
+    this->height = height;
+
+    if (this->format == CaptureFormat::Y4M)
+    {
+        this->video_file.open(this->path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!this->video_file)
+        {
+            std::cout << "!!ERROR: Could not open " << this->path << " for frame capture." << std::endl;
+            return false;
+        }
+        // Full range 4:2:0 (the chroma planes are half width and half height, rounded up).
+        // Without XCOLORRANGE=FULL, players read the samples as limited range (16-235).
+        this->video_file << "YUV4MPEG2 W" << width << " H" << height << " F" << this->frame_rate
+            << ":1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n";
+        if (!this->video_file.good())
+        {
+            std::cout << "!!ERROR: Could not write the video header to " << this->path << "." << std::endl;
+            this->video_file.close();
+            return false;
+        }
+    }
+
+    // Allocate every buffer up front so that capturing does no allocation per frame
+    this->free_frames.clear();
+    this->queued_frames.clear();
+    for (size_t i = 0; i < this->frame_pool.size(); ++i)
+    {
+        this->frame_pool[i].resize(width * height);
+        this->free_frames.push_back(i);
+    }
+
+    this->frames_written = 0;
+    this->frames_dropped = 0;
+    this->write_failed = false;
+    this->stop_requested = false;
+    this->is_open = true;
+    this->writer = std::thread(&FrameCapture::WriterLoop, this);
+
+    std::cout << "~ Capturing frames to " << this->path << std::endl;
+    return true;
+}
+
+bool FrameCapture::SubmitFrame(const FrameBuffer& frame)
+{
+    if (!this->is_open || this->write_failed)
+    {
+        return false;
+    }
+    if (frame.GetWidth() != this->width || frame.GetHeight() != this->height)
+    {
+        std::cout << "!!ERROR: Frame is " << frame.GetWidth() << "x" << frame.GetHeight()
+            << ", but the capture was opened for " << this->width << "x" << this->height << "." << std::endl;
+        return false;
+    }
+
+    // Claim a free buffer (or give up on this frame)
+    int slot;
+    {
+        std::unique_lock<std::mutex> lock(this->queue_mutex);
+        if (this->free_frames.empty())
+        {
+            if (!this->block_when_full)
+            {
+                this->frames_dropped++;
+                return false;
+            }
+            this->frame_freed.wait(lock, [this] { return !this->free_frames.empty(); });
+        }
+        slot = this->free_frames.back();
+        this->free_frames.pop_back();
+    }
+
+    // Copy outside of the lock so the writer thread can keep working (rows are packed tightly in the copy)
+    for (int row = 0; row < this->height; ++row)
+    {
+        std::memcpy(this->frame_pool[slot].data() + row * this->width, frame.GetLinearRow(row), this->width * sizeof(uint32_t));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->queue_mutex);
+        this->queued_frames.push_back(slot);
+    }
+    this->frame_queued.notify_one();
+    return true;
+}
+
+void FrameCapture::Close()
+{
+    if (!this->is_open)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->queue_mutex);
+        this->stop_requested = true;
+    }
+    this->frame_queued.notify_one();
+    this->writer.join();
+
+    if (this->video_file.is_open())
+    {
+        // Closing flushes the last of the stream, which can fail too
+        this->video_file.close();
+        if (this->video_file.fail() && !this->write_failed)
+        {
+            std::cout << "!!ERROR: Could not finish writing " << this->path << "." << std::endl;
+            this->write_failed = true;
+        }
+    }
+    this->is_open = false;
+
+    if (this->write_failed)
+    {
+        std::cout << "!!ERROR: Frame capture failed after " << this->frames_written << " frames; the output is incomplete." << std::endl;
+        return;
+    }
+    std::cout << "~ Frame capture finished: " << this->frames_written << " frames written, "
+        << this->frames_dropped << " dropped" << std::endl;
+}
+
+void FrameCapture::WriterLoop()
+{
+    int slot;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(this->queue_mutex);
+            this->frame_queued.wait(lock, [this] { return this->stop_requested || !this->queued_frames.empty(); });
+
+            // Only stop once every queued frame has been written
+            if (this->queued_frames.empty())
+            {
+                return;
+            }
+            slot = this->queued_frames.front();
+            this->queued_frames.pop_front();
+        }
+
+        // After a failed write (a full disk, for example), the remaining frames are only given back
+        if (!this->write_failed)
+        {
+            bool written;
+            if (this->format == CaptureFormat::PPM_SEQUENCE)
+            {
+                written = this->WritePPM(this->frame_pool[slot], this->frames_written);
+            }
+            else
+            {
+                written = this->WriteY4MFrame(this->frame_pool[slot]);
+            }
+
+            if (written)
+            {
+                this->frames_written++;
+            } else {
+                std::cout << "!!ERROR: Could not write frame " << this->frames_written << " to " << this->path
+                    << ". Stopping frame capture." << std::endl;
+                this->write_failed = true;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->queue_mutex);
+            this->free_frames.push_back(slot);
+        }
+        this->frame_freed.notify_one();
+    }
+}
+
+bool FrameCapture::WritePPM(const std::vector<uint32_t>& pixels, int frame_number)
+{
+    char file_name[32];
+    std::snprintf(file_name, sizeof(file_name), "_%05d.ppm", frame_number);
+
+    std::ofstream image(this->path + file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!image)
+    {
+        std::cout << "!!ERROR: Could not write " << this->path << file_name << std::endl;
+        return false;
+    }
+
+    // Unpack ARGB8888 into tightly packed RGB bytes
+    int num_pixels = this->width * this->height;
+    this->write_buffer.resize(num_pixels * 3);
+    for (int i = 0; i < num_pixels; ++i)
+    {
+        this->write_buffer[3 * i] = (pixels[i] >> 16) & 0xFF;
+        this->write_buffer[3 * i + 1] = (pixels[i] >> 8) & 0xFF;
+        this->write_buffer[3 * i + 2] = pixels[i] & 0xFF;
+    }
+
+    image << "P6\n" << this->width << " " << this->height << "\n255\n";
+    image.write(reinterpret_cast<const char*>(this->write_buffer.data()), this->write_buffer.size());
+    image.close();
+    return !image.fail();
+}
+
+bool FrameCapture::WriteY4MFrame(const std::vector<uint32_t>& pixels)
+{
+    int chroma_width = (this->width + 1) / 2;
+    int chroma_height = (this->height + 1) / 2;
+    int luma_size = this->width * this->height;
+    int chroma_size = chroma_width * chroma_height;
+
+    this->write_buffer.resize(luma_size + 2 * chroma_size);
+    uint8_t* y_plane = this->write_buffer.data();
+    uint8_t* u_plane = y_plane + luma_size;
+    uint8_t* v_plane = u_plane + chroma_size;
+
+    // Luma for every pixel (BT.601 full range, 8-bit fixed point weights)
+    int r, g, b;
+    for (int i = 0; i < luma_size; ++i)
+    {
+        r = (pixels[i] >> 16) & 0xFF;
+        g = (pixels[i] >> 8) & 0xFF;
+        b = pixels[i] & 0xFF;
+        y_plane[i] = uint8_t((77 * r + 150 * g + 29 * b + 128) >> 8);
+    }
+
+    // Chroma from the average color of each 2x2 block
+    int sum_r, sum_g, sum_b, count;
+    uint32_t pixel;
+    for (int cy = 0; cy < chroma_height; ++cy)
+    {
+        for (int cx = 0; cx < chroma_width; ++cx)
+        {
+            sum_r = 0;
+            sum_g = 0;
+            sum_b = 0;
+            count = 0;
+            for (int y = 2 * cy; y < 2 * cy + 2 && y < this->height; ++y)
+            {
+                for (int x = 2 * cx; x < 2 * cx + 2 && x < this->width; ++x)
+                {
+                    pixel = pixels[y * this->width + x];
+                    sum_r += (pixel >> 16) & 0xFF;
+                    sum_g += (pixel >> 8) & 0xFF;
+                    sum_b += pixel & 0xFF;
+                    count++;
+                }
+            }
+            r = sum_r / count;
+            g = sum_g / count;
+            b = sum_b / count;
+            u_plane[cy * chroma_width + cx] = uint8_t(clamp((-43 * r - 85 * g + 128 * b + 32768 + 128) >> 8, 0, 255));
+            v_plane[cy * chroma_width + cx] = uint8_t(clamp((128 * r - 107 * g - 21 * b + 32768 + 128) >> 8, 0, 255));
+        }
+    }
+
+    this->video_file << "FRAME\n";
+    this->video_file.write(reinterpret_cast<const char*>(this->write_buffer.data()), this->write_buffer.size());
+    return this->video_file.good();
+}
+
+
+/*************************************************************/
+/*          Sending frames from the GraphicsManager          */
+/*************************************************************/
+
+void GraphicsManager::StartCapture(FrameCapture* capture)
+{
+    this->StopCapture();
+    if (capture->Open(this->canvas_width, this->canvas_height))
+    {
+        this->frame_capture = capture;
+    }
+}
+
+void GraphicsManager::StopCapture()
+{
+    if (this->frame_capture != nullptr)
+    {
+        this->frame_capture->Close();
+        this->frame_capture = nullptr;
+    }
+}
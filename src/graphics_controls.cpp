@@ -23,6 +23,12 @@ HomCoordinates MovementVector(float rotation[3], float localDirection[3])
  */
 void GraphicsManager::StayOpenCameraControls()
 {
+	if (this->is_offscreen)
+	{
+		std::cout << "!!WARNING: Camera controls need a window, but this GraphicsManager renders offscreen." << std::endl;
+		return;
+	}
+
 	InputModule input = InputModule(this->event_handler);
 
 	
@@ -8,6 +8,7 @@
  */
 
 #include "../lib/graphics.h"
+#include <algorithm>
 
 /*
  * Draws a triangle to the screen, respecting the depth buffer and only drawing pixels that are closer
@@ -15,115 +16,137 @@
  */
 void GraphicsManager::DrawDepthTriangle(Point2D p0, Point2D p1, Point2D p2, Color color, 
 		float h0, float h1, float h2)
+{
+	this->DrawDepthTriangle(ToSubPixel(p0), ToSubPixel(p1), ToSubPixel(p2), color, h0, h1, h2);
+}
+
+/*
+ * Draws a depth tested triangle with sub-pixel (28.4 fixed point) vertex positions.
+ */
+void GraphicsManager::DrawDepthTriangle(SubPixelPoint p0, SubPixelPoint p1, SubPixelPoint p2, Color color,
+		float h0, float h1, float h2)
+{
+	this->SubmitDepthTriangle(p0, p1, p2, RasterMode::DEPTH, FrameBuffer::PackColor(color), h0, h1, h2);
+}
+
+/*
+ * Draws a depth tested triangle's ID into the visibility buffer.
+ */
+void GraphicsManager::DrawVisibilityTriangle(SubPixelPoint p0, SubPixelPoint p1, SubPixelPoint p2, uint32_t id,
+		float h0, float h1, float h2)
+{
+	this->SubmitDepthTriangle(p0, p1, p2, RasterMode::VISIBILITY, id, h0, h1, h2);
+}
+
+/*
+ * Sets up a depth tested triangle, then draws it now or adds it to the batch.
+ *
+ * @param mode - DEPTH to write a color to the frame buffer, VISIBILITY to write an ID to the visibility buffer
+ * @param value - the packed color or the triangle ID
+ */
+void GraphicsManager::SubmitDepthTriangle(SubPixelPoint p0, SubPixelPoint p1, SubPixelPoint p2, RasterMode mode, uint32_t value,
+		float h0, float h1, float h2)
 {
     // NOTE: In this function, the h-values correspond to 1/z for the points, representing their
-    // depth.
+    // depth. 1/z is linear in screen space, so it is interpolated exactly as a plane.
+	// Multisampled triangles can cover samples in pixels next to their pixel center bounds
+	bool multisampled = mode == RasterMode::DEPTH && this->sample_buffer.IsActive();
+	TriangleSetup setup;
+	if (!this->SetupTriangle(p0, p1, p2, setup, multisampled ? 1 : 0))
+	{
+		return;
+	}
+	setup.mode = mode;
+	setup.packed_color = value;
+	this->SetupAttributePlane(setup, h0, h1, h2);
 
-	float temph;
-	// Sort points so that p0 has the lowest y value and p2 has the highest
-	if (p1.y < p0.y)
+	if (this->is_batching)
 	{
-		SwapPoints(p1, p0);
-		temph = h1;
-		h1 = h0;
-		h0 = temph;
+		// Drawn in parallel by EndTriangleBatch()
+		this->tile_binner.AddTriangle(setup);
 	}
-	if (p2.y < p0.y)
+	else
 	{
-		SwapPoints(p2, p0);
-		temph = h2;
-		h2 = h0;
-		h0 = temph;
+		this->RasterizeTriangle(setup, this->GetScreenRect());
 	}
-	if (p2.y < p1.y)
+}
+
+/*
+ * Changes how the depth buffer stores depth values, recreating it if the canvas is open.
+ */
+void GraphicsManager::SetDepthFormat(DepthFormat format)
+{
+	this->depth_format = format;
+	if (this->canvas_width > 0)
 	{
-		SwapPoints(p2, p1);
-		temph = h2;
-		h2 = h1;
-		h1 = temph;
+		this->depth_buffer = DepthBuffer(this->canvas_width, this->canvas_height, format, this->buffer_layout);
 	}
-	
-	// We will fill in the triangle with horizontal lines.
-	// To do this, we need a list of x values for the left side of the lines,
-	// and a list of x values for the right side of the lines.
-	// One of these sides will be made by the longest edge of the triangle.
-
-	// Long edge is from point 0 to point 2 (the highest and lowest points)
-	float long_side_xs[ p2.y - p0.y + 1 ];
-	Interpolate(p0.y, p0.x, p2.y, p2.x, &(long_side_xs[0]));
-	
-	// Also now we want to get h values for the edges to determine the color of each pixel
-	float long_side_hs[ p2.y - p0.y + 1];
-	Interpolate(p0.y, h0, p2.y, h2, &(long_side_hs[0]));
-
-	// Two short edges make the other list of x values.
-	// This list should match the long_side_xs in length
-	float combined_side_xs[ p2.y - p0.y + 1];
-	float combined_side_hs[ p2.y - p0.y + 1];
-
-	// Starting from the bottom to match the other list, we compute p0 -> p1.
-	Interpolate(p0.y, p0.x, p1.y, p1.x, &(combined_side_xs[0]));
-	Interpolate(p0.y, h0, p1.y, h1, &(combined_side_hs[0]));
-	
-	// We will then add the next segment from p1 -> p2.
-	// Note that one point, namely p1, was computed in the previous statement, so we will overwrite it
-	int p1_index = p1.y - p0.y;	
-	Interpolate(p1.y, p1.x, p2.y, p2.x, &(combined_side_xs[p1_index]));
-	Interpolate(p1.y, h1, p2.y, h2, &(combined_side_hs[p1_index]));	
-
-	// Determine which list is the left side and which is right.
-	float* left_x_list;
-	float* left_h_list;
-	float* right_x_list;
-	float* right_h_list;
-	if (long_side_xs[p1_index] < combined_side_xs[p1_index])
+}
+
+/*
+ * Changes how scenes shade their triangles, allocating the visibility buffer if it is needed.
+ */
+void GraphicsManager::SetShadingMode(ShadingMode mode)
+{
+	this->shading_mode = mode;
+	if (mode == ShadingMode::DEFERRED && this->canvas_width > 0)
 	{
-		left_x_list = &(long_side_xs[0]);
-		right_x_list = &(combined_side_xs[0]);
-		left_h_list = &(long_side_hs[0]);
-		right_h_list = &(combined_side_hs[0]);
+		this->visibility_buffer = FrameBuffer(this->canvas_width, this->canvas_height, this->buffer_layout);
 	}
-	else
-	{	
-		right_x_list = &(long_side_xs[0]);
-		left_x_list = &(combined_side_xs[0]);
-		left_h_list = &(combined_side_hs[0]);
-		right_h_list = &(long_side_hs[0]);
+	else if (mode == ShadingMode::FORWARD)
+	{
+		this->visibility_buffer = FrameBuffer();
 	}
+}
 
-	// We now have a list of x values and h values that correspond to 
-	// every y value on the left and right sides of the triangle.
-
-	// Draw horizontal lines
-	int y_index;
-	int segment_width;
-	Color pixel_color;
-
-    float z_val;
+void GraphicsManager::ClearVisibilityBuffer()
+{
+	this->visibility_buffer.Fill(0);
+}
 
-	for(int y = p0.y; y <= p2.y; ++y)
+/*
+ * Shades every pixel that has a triangle in the visibility buffer, one band of rows per task.
+ */
+void GraphicsManager::ResolveVisibilityBuffer(const std::function<uint32_t(uint32_t)>& shade)
+{
+	// band_height is a constant, so the lambda does not capture it and stays small enough for
+	// std::function to hold without allocating
+	const int band_height = TileBinner::tile_size;
+	int num_bands = (this->canvas_height + band_height - 1) / band_height;
+	this->render_threads.Run(num_bands, [this, &shade](int band, int thread_index)
 	{
-		y_index = y - p0.y;
-		// For each line, interpolate the h values for the depth
-		segment_width = int(right_x_list[y_index]) - int(left_x_list[y_index]) + 1;
-		float h_segment[ segment_width ];
-
-        // Interpolate the x values on this line with the h (depth) values
-		Interpolate(int(left_x_list[y_index]), left_h_list[y_index],
-			int(right_x_list[y_index]), right_h_list[y_index], &(h_segment[0]));
-
-		// Draw the line, checking the depth of each pixel
-		for(int x = left_x_list[y_index]; x <= right_x_list[y_index]; ++x)
+		// Neighbouring pixels usually show the same triangle, so only shade when the ID changes
+		uint32_t last_id = 0;
+		uint32_t last_color = 0;
+		uint32_t id;
+		uint32_t* row_ids;
+		uint32_t* row_pixels;
+		int offset;
+
+		int last_row = std::min((band + 1) * band_height, this->canvas_height);
+		for (int row = band * band_height; row < last_row; ++row)
 		{
-			z_val = h_segment[x - int(left_x_list[y_index])];
-            if (z_val > this->depth_buffer(x, y))   // Higher 1/z value means lower z, closer to camera than existing pixel
-            {
-                this->PutPixel(x, y, color);
-                this->depth_buffer(x, y) = z_val;
-            }
+			// Both buffers have the same layout, so pixel x has the same offset in both rows
+			row_ids = this->visibility_buffer.GetRow(row);
+			row_pixels = this->frame_buffer.GetRow(row);
+			for (int x = 0; x < this->canvas_width; ++x)
+			{
+				offset = this->frame_buffer.ColumnOffset(x);
+				id = row_ids[offset];
+				if (id == 0)
+				{
+					// Nothing was drawn here
+					continue;
+				}
+				if (id != last_id)
+				{
+					last_color = shade(id);
+					last_id = id;
+				}
+				row_pixels[offset] = last_color;
+			}
 		}
-	}
-
+	});
 }
 
 /*
@@ -137,32 +160,32 @@ void GraphicsManager::DrawDepthTriangle(Point2D p0, Point2D p1, Point2D p2, Colo
 void RenderableModelInstance::CullBackFaces()
 {
 
-	// Iterate through all of the triangles
+	// Iterate through all of the triangles, copying the front-facing ones into clipped_tris
 	HomCoordinates tri_to_camera;
 	HomCoordinates vec1;
 	HomCoordinates vec2;
 	HomCoordinates tri_normal;
-	Triangle candidate;
 	float dot_product;
-	for (std::vector<Triangle>::iterator iterator = this->triangles.begin(); iterator != this->triangles.end(); iterator++)
+	this->clipped_tris.clear();
+	for (const Triangle& candidate : this->triangles)
 	{
-		candidate = *iterator;	// Triangle to possibly cull
-
 		// See if the triangle is back-facing
-		tri_to_camera = -1 * (this->points[candidate.p0]); 	// Vector from the camera to a vertex of the triangle (camera is at 0, 0)
-		vec1 = this->points[candidate.p1] - this->points[candidate.p0];	// Vector from A to B on triangle ABC
-		vec2 = this->points[candidate.p2] - this->points[candidate.p0];	// Vector from A to C on triangle ABC
+		tri_to_camera = -1 * (this->points.Get(candidate.p0)); 	// Vector from the camera to a vertex of the triangle (camera is at 0, 0)
+		vec1 = this->points.Get(candidate.p1) - this->points.Get(candidate.p0);	// Vector from A to B on triangle ABC
+		vec2 = this->points.Get(candidate.p2) - this->points.Get(candidate.p0);	// Vector from A to C on triangle ABC
 		tri_normal = HomCoordinates::CrossProduct(vec1, vec2);
 
 	
 		dot_product = HomCoordinates::DotProduct(tri_normal, tri_to_camera);
 		if ( dot_product < 0)	// If triangle is back-facing
-		{	
-			// std::cout << "Culling. Dot product: " << dot_product << " normal: (" << tri_normal[0] << ", " << tri_normal[1] << ", " << tri_normal[2] << ")" <<  std::endl;
-			// Cull it! remove the triangle from the list of triangles.
-			this->triangles.erase(iterator);
-			iterator--;
+		{
+			// Cull it! leave the triangle out of the new list of triangles.
+			continue;
 		}
+		this->clipped_tris.push_back(candidate);
 	}
 
+	// Keep the culled list; the old list's memory is reused next time
+	this->triangles.swap(this->clipped_tris);
+
 }
\ No newline at end of file
@@ -1,88 +1,168 @@
 /* graphics_line.cpp
  * Defines functions for creating a line
- * 
+ *
+ * Lines are clipped to the canvas up front (Cohen-Sutherland), then drawn with
+ * Bresenham's algorithm, which steps from pixel to pixel with integer math only
+ * and writes straight into the frame buffer.
+ *
  * @author Alex Wills
  * @date February 16, 2023
  */
 
+#include <cmath>
 #include <cstdlib>
 
 #include "../lib/graphics.h"
 
+// Cohen-Sutherland region codes: which sides of the screen a point is past
+static const int OUTSIDE_LEFT = 1;
+static const int OUTSIDE_RIGHT = 2;
+static const int OUTSIDE_TOP = 4;
+static const int OUTSIDE_BOTTOM = 8;
+
 /*
- * Draws a line on the graphics manager from point 0 to point 1.
+ * Returns the region code of a point in buffer space (0 if the point is on the screen).
+ */
+static int ComputeOutCode(int64_t x, int64_t y, const ScreenRect& screen)
+{
+	int code = 0;
+	if (x < screen.min_x)
+	{
+		code |= OUTSIDE_LEFT;
+	}
+	else if (x > screen.max_x)
+	{
+		code |= OUTSIDE_RIGHT;
+	}
+	if (y < screen.min_y)
+	{
+		code |= OUTSIDE_TOP;
+	}
+	else if (y > screen.max_y)
+	{
+		code |= OUTSIDE_BOTTOM;
+	}
+	return code;
+}
+
+/*
+ * Clips a line segment in buffer space to a rectangle with the Cohen-Sutherland algorithm.
+ * Each endpoint that is off the screen is moved to where the line crosses the edge of the screen.
  *
- * @param p0 - the point where the line begins
- * @param p1 - the point where the line ends
+ * @param x0, y0, x1, y1 - the endpoints of the line, replaced with the clipped endpoints
+ * @return false if no part of the line is on the screen
  */
-void GraphicsManager::DrawLine(Point2D p0, Point2D p1)
+static bool ClipLine(int64_t& x0, int64_t& y0, int64_t& x1, int64_t& y1, const ScreenRect& screen)
 {
-    int deltax = p1.x - p0.x;
-	int deltay = p1.y - p0.y;
-	
-	if (abs(deltax) > abs(deltay))
+	int code0 = ComputeOutCode(x0, y0, screen);
+	int code1 = ComputeOutCode(x1, y1, screen);
+
+	// Every clip puts one coordinate exactly on an edge, so a few passes are always enough
+	for (int pass = 0; pass < 8; ++pass)
 	{
-		// Line is mostly horizontal
-		// Ensure x0 < x1
-		if (p0.x > p1.x)
+		if ((code0 | code1) == 0)
 		{
-			SwapPoints(p0, p1);
+			// Both points are on the screen
+			return true;
 		}
-
-		// Make x the dependent variable and interpolate
-		int num_values = p1.x - p0.x + 1;
-		// TODO: Fix this DUCTTAPE code
-		// Manual check to make sure that the line is for real
-		if (num_values > 0 && num_values < 10000)
+		if ((code0 & code1) != 0)
 		{
-			float y_values[num_values];
-			float* y_values_ptr = &(y_values[0]);
-			Interpolate(p0.x, p0.y, p1.x, p1.y, y_values_ptr);
-
-			// Draw the line
-			for (int i = 0; i < num_values; ++i)
-			{
-				this->PutPixel(p0.x + i, int(y_values[i]));
-			}
+			// Both points are past the same side of the screen
+			return false;
+		}
 
-		} else 
+		// Move a point that is off the screen onto the edge it is past
+		int code = (code0 != 0) ? code0 : code1;
+		double x, y;
+		if (code & OUTSIDE_TOP)
+		{
+			y = screen.min_y;
+			x = x0 + double(x1 - x0) * (y - y0) / double(y1 - y0);
+		}
+		else if (code & OUTSIDE_BOTTOM)
+		{
+			y = screen.max_y;
+			x = x0 + double(x1 - x0) * (y - y0) / double(y1 - y0);
+		}
+		else if (code & OUTSIDE_RIGHT)
 		{
-			std::cout << "What! Horizontal Line with " << num_values << " points" << std::endl;
-			std::cout << "\tp1 y: " << p1.y << " - p0.y: " << p0.y << std::endl;
+			x = screen.max_x;
+			y = y0 + double(y1 - y0) * (x - x0) / double(x1 - x0);
+		}
+		else
+		{
+			x = screen.min_x;
+			y = y0 + double(y1 - y0) * (x - x0) / double(x1 - x0);
+		}
 
+		if (code == code0)
+		{
+			x0 = std::llround(x);
+			y0 = std::llround(y);
+			code0 = ComputeOutCode(x0, y0, screen);
 		}
+		else
+		{
+			x1 = std::llround(x);
+			y1 = std::llround(y);
+			code1 = ComputeOutCode(x1, y1, screen);
+		}
+	}
+	return false;
+}
 
+/*
+ * Draws a line on the graphics manager from point 0 to point 1.
+ *
+ * @param p0 - the point where the line begins
+ * @param p1 - the point where the line ends
+ */
+void GraphicsManager::DrawLine(Point2D p0, Point2D p1)
+{
+	// Move the points into buffer space (y points down) and cut off the parts that are off the screen
+	int64_t x0 = this->ScreenColumn(p0.x);
+	int64_t y0 = this->ScreenRow(p0.y);
+	int64_t x1 = this->ScreenColumn(p1.x);
+	int64_t y1 = this->ScreenRow(p1.y);
+	if (!ClipLine(x0, y0, x1, y1, this->GetScreenRect()))
+	{
+		return;
 	}
-	else
+
+	// Bresenham: step along the line one pixel at a time. error tracks how far the pixels
+	// have drifted from the real line (scaled to stay an integer), and decides when to
+	// step in x, in y, or both.
+	int x = int(x0);
+	int y = int(y0);
+	int delta_x = std::abs(int(x1 - x0));
+	int delta_y = -std::abs(int(y1 - y0));
+	int step_x = (x0 < x1) ? 1 : -1;
+	int step_y = (y0 < y1) ? 1 : -1;
+	int error = delta_x + delta_y;
+	int error2;
+
+	uint32_t* row_pixels = this->frame_buffer.GetRow(y);
+	uint32_t color = this->brush_color;
+	while (true)
 	{
-		// Line is mostly vertical
-		// Ensure y0 < y1
-		if (p0.y > p1.y)
+		row_pixels[this->frame_buffer.ColumnOffset(x)] = color;
+		this->drawCount++;
+		if (x == x1 && y == y1)
 		{
-			SwapPoints(p0, p1);
+			break;
 		}
 
-		// Make y the dependent variable and interpolate
-		int num_values = p1.y - p0.y + 1;
-		// TODO: Fix this DUCTTAPE code
-		// Manual check to make sure that the line is for real
-		if (num_values > 0 && num_values < 10000)
+		error2 = 2 * error;
+		if (error2 >= delta_y)
 		{
-
-			float x_values[num_values];
-			float* x_values_ptr = &(x_values[0]);
-			Interpolate(p0.y, p0.x, p1.y, p1.x, x_values_ptr);
-
-			// Draw the line
-			for (int i = 0; i < num_values; ++i)
-			{
-				this->PutPixel(int(x_values[i]), p0.y + i);
-			}
+			error += delta_y;
+			x += step_x;
 		}
-		else 
+		if (error2 <= delta_x)
 		{
-			std::cout << "What! Vertical Line with " << num_values << " points" << std::endl;
-			std::cout << "\tp1 y: " << p1.y << " - p0.y: " << p0.y << std::endl;
+			error += delta_x;
+			y += step_y;
+			row_pixels = this->frame_buffer.GetRow(y);
 		}
 	}
 }
@@ -98,4 +178,4 @@ void GraphicsManager::DrawLine(Point2D p0, Point2D p1, Color color)
 {
 	this->ChangeBrushColor(color);
 	this->DrawLine(p0, p1);
-}
\ No newline at end of file
+}
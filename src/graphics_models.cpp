@@ -1,254 +1,329 @@
 
 #include "../lib/graphics.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 
+/*
+ * Returns the distance from the center to the farthest vertex.
+ */
+static float FarthestDistance(const std::vector<Point3D>& vertices, const HomCoordinates& center)
+{
+    float farthest = 0;
+    for (const Point3D& vertex : vertices)
+    {
+        farthest = std::max(farthest, std::sqrt(
+            (vertex.x - center[0]) * (vertex.x - center[0]) +
+            (vertex.y - center[1]) * (vertex.y - center[1]) +
+            (vertex.z - center[2]) * (vertex.z - center[2])));
+    }
+    return farthest;
+}
 
 /*
- * Based on this instance's model and transform, set the list of worldspace points
+ * Copies the vertices into the vertex stream and fits a bounding sphere around them. This only
+ * happens when the vertices change, so it can afford a few passes over them.
  */
-void RenderableModelInstance::GenerateWorldspacePoints()
+void Model::UpdateVertexStream()
 {
-    int num_points = this->model->vertices.size();
+    int num_points = this->vertices.size();
+    this->vertex_stream.Resize(num_points);
+    for (int i = 0; i < num_points; ++i)
+    {
+        this->vertex_stream.Set(i, this->vertices[i]);
+    }
+    this->vertices_changed = false;
 
-    this->points.clear();
-    this->points.resize(num_points);
+    this->bounding_sphere_center = HomCoordinates(0, 0, 0, 1);
+    this->bounding_sphere_radius = 0;
+    if (num_points == 0)
+    {
+        return;
+    }
 
-    HomCoordinates newPoint;
-    TransformMatrix world_space_transform = this->transform;
+    // Ritter's sphere: start with the two vertices farthest apart (roughly), then grow the
+    // sphere just enough to take in every vertex that is still outside of it
+    auto distance_squared = [](const Point3D& a, const Point3D& b)
+    {
+        return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z);
+    };
+    Point3D start = this->vertices[0];
+    Point3D end = start;
+    for (const Point3D& vertex : this->vertices)
+    {
+        if (distance_squared(vertex, start) > distance_squared(end, start))
+            end = vertex;
+    }
+    start = end;
+    for (const Point3D& vertex : this->vertices)
+    {
+        if (distance_squared(vertex, start) > distance_squared(end, start))
+            end = vertex;
+    }
+    HomCoordinates ritter_center((start.x + end.x) / 2, (start.y + end.y) / 2, (start.z + end.z) / 2, 1);
+    float ritter_radius = std::sqrt(distance_squared(start, end)) / 2;
+    float distance;
+    for (const Point3D& vertex : this->vertices)
+    {
+        HomCoordinates offset(vertex.x - ritter_center[0], vertex.y - ritter_center[1], vertex.z - ritter_center[2], 0);
+        distance = std::sqrt(HomCoordinates::DotProduct(offset, offset));
+        if (distance > ritter_radius)
+        {
+            // Move the center toward the vertex so the new sphere just touches it and the old sphere's far side
+            ritter_radius = (ritter_radius + distance) / 2;
+            ritter_center = ritter_center + offset * ((distance - ritter_radius) / distance);
+        }
+    }
 
-    for (int i = 0; i < num_points; ++i)
+    // Also try the average of the vertices, and keep whichever center gives the smaller sphere.
+    // Measuring the radius again from the final center keeps rounding from leaving any vertex outside.
+    HomCoordinates average(0, 0, 0, 1);
+    for (const Point3D& vertex : this->vertices)
     {
-        // Get the model-space point as homogenous coordinates
-        newPoint = HomCoordinates(model->vertices[i]);
-		
-		// Apply matrix to convert to world space
-		newPoint = world_space_transform * newPoint;
+        average[0] += vertex.x;
+        average[1] += vertex.y;
+        average[2] += vertex.z;
+    }
+    average[0] /= num_points;
+    average[1] /= num_points;
+    average[2] /= num_points;
 
-        this->points[i] = newPoint;  // Pass the point into the instance array by value
+    float ritter_farthest = FarthestDistance(this->vertices, ritter_center);
+    float average_farthest = FarthestDistance(this->vertices, average);
+    if (ritter_farthest <= average_farthest)
+    {
+        this->bounding_sphere_center = ritter_center;
+        this->bounding_sphere_radius = ritter_farthest;
     }
+    else
+    {
+        this->bounding_sphere_center = average;
+        this->bounding_sphere_radius = average_farthest;
+    }
+}
+
+void RenderableModelInstance::PlaceBoundingSphere(const TransformMatrix& matrix)
+{
+    this->bounding_sphere_center = matrix * this->model->GetBoundingSphereCenter();
+    this->bounding_sphere_radius = this->GetScaledBoundingSphereRadius();
+}
+
+/*
+ * Based on this instance's model and transform, set the list of worldspace points
+ */
+void RenderableModelInstance::GenerateWorldspacePoints()
+{
+    // Apply the matrix to every model-space point at once, to convert them to world space
+    this->points.TransformFrom(this->model->GetVertexStream(), this->transform.GetMatrix());
+    this->PlaceBoundingSphere(this->transform.GetMatrix());
 
     this->in_camera_space = false;  // Points are now in world space, not in camera space. Also, any clipping has been undone.
 }
 
-void RenderableModelInstance::ApplyTransform(TransformMatrix transform)
+void RenderableModelInstance::GenerateCameraspacePoints(const TransformMatrix& model_to_camera)
 {
-    for (int i = 0; i < points.size(); ++i)
+    // Model space -> world space -> camera space, composed by the caller into a single model-view matrix
+    this->points.TransformFrom(this->model->GetVertexStream(), model_to_camera);
+    this->PlaceBoundingSphere(model_to_camera);
+
+    this->in_camera_space = true;   // Any clipping has been undone
+}
+
+const VertexStream& RenderableModelInstance::GetWorldspacePoints()
+{
+    if (!this->world_points_ready)
     {
-        this->points[i] = transform * this->points[i];
+        this->world_points.TransformFrom(this->model->GetVertexStream(), this->transform.GetMatrix());
+        this->world_points_ready = true;
     }
+    return this->world_points;
+}
+
+void RenderableModelInstance::ApplyTransform(TransformMatrix transform)
+{
+    this->points.TransformFrom(this->points, transform);
+    this->bounding_sphere_center = transform * this->bounding_sphere_center;
 
     this->in_camera_space = true;
 }
 
 /*
- * Generates a bounding sphere that includes all points in this model instance.
+ * A corner of a polygon being clipped: the index of its point, and the point itself.
  */
-void RenderableModelInstance::GenerateBoundingSphere()
+struct ClipVertex {
+    int index;
+    HomCoordinates point;
+};
+
+void RenderableModelInstance::ClipTrianglesAgainstPlanes(Plane * const planes[], int plane_count)
 {
-    // First, find a rough center of the sphere by averaging all of the points
-    HomCoordinates center;
-    if (points.size() > 0)
-    {
-        for (HomCoordinates point : this->points)
-        {
-            center = center + point;
-        }
-        center = center / this->points.size();
-    }
-    center[3] = 1;
+    // Outcodes have one bit per plane, so more planes than that cannot be clipped against
+    assert(plane_count <= max_clip_planes);
 
-    // Now find the largest distance between the center and a point (the radius)
-    float radius = 0;
-    float distance;
-    for (HomCoordinates point : this->points)
+    // Points are tested against the planes the first time a triangle uses them, and the result (the
+    // point's outcode) is kept, so the triangles sharing a point do not test it again
+    this->outcodes.assign(this->points.Size(), untested_outcode);
+
+    // Forget the edges cut last time, keeping the table's memory
+    std::fill(this->cut_edges.begin(), this->cut_edges.end(), CutEdge{0, 0, 0, -1});
+    this->cut_edge_count = 0;
+
+    // Write the surviving triangles to a second list instead of erasing from this one
+    this->clipped_tris.clear();
+    uint8_t code0, code1, code2;
+    for (const Triangle& triangle : this->triangles)
     {
-        distance = std::sqrt(
-            std::pow(point[0] - center[0], 2) +
-            std::pow(point[1] - center[1], 2) +
-            std::pow(point[2] - center[2], 2)
-        );
+        code0 = this->GetOutcode(triangle.p0, planes, plane_count);
+        code1 = this->GetOutcode(triangle.p1, planes, plane_count);
+        code2 = this->GetOutcode(triangle.p2, planes, plane_count);
 
-        if (distance > radius)
-            radius = distance;        
+        if ((code0 | code1 | code2) == 0)
+        {
+            // Every corner is inside every plane, so the triangle is kept as it is
+            this->clipped_tris.push_back(triangle);
+        } else if ((code0 & code1 & code2) == 0)
+        {
+            // The corners are not all outside of the same plane, so the triangle may be partly inside
+            this->ClipTriangle(triangle, code0 | code1 | code2, planes, plane_count);
+        }
+        // Otherwise every corner is outside of one plane, and the triangle is dropped
     }
 
-    this->bounding_sphere_center = center;
-    this->bounding_sphere_radius = radius;
+    // The clipped list becomes the triangle list, and the old list is kept (with its memory) for the next time
+    this->triangles.swap(this->clipped_tris);
 }
 
-
-void RenderableModelInstance::ClipTrianglesAgainstPlane(Plane* plane)
+/*
+ * Clips a triangle against the planes it crosses, one at a time, as a polygon. Clipping a
+ * triangle against 5 planes leaves a convex polygon with at most 8 corners. The polygon is split
+ * into a fan of triangles around its flattest corner, so that a corner of the screen is more often
+ * covered by a single triangle (which lets the depth buffer's HiZ level mark it as covered). The
+ * triangles keep the original triangle's winding and color.
+ */
+void RenderableModelInstance::ClipTriangle(const Triangle& to_clip, uint8_t crossed, Plane * const planes[], int plane_count)
 {
-    // I am using buffer lists to add triangles to our lists for 2 reasons:
-        // 1: calling push_back multiple times (adding 2 triangles) seems to mess up the iterator (at least when tested with ints)
-        // 2: we do not need to clip the triangles that are added to the list
-    new_tris.clear();   // List of new triangles to add to this render instance
-    new_points.clear(); // List of new points to add to this render instance, for the new triangles
-    new_point_start_index = this->points.size(); // Index to start building new triangles
+    // Every plane adds at most one corner to a convex polygon
+    constexpr int capacity = 3 + max_clip_planes;
+    ClipVertex buffers[2][capacity];
+    bool inside[capacity];
+    ClipVertex* input = buffers[0];
+    ClipVertex* output = buffers[1];
+    int input_count = 3;
+    int output_count;
+    input[0] = {to_clip.p0, this->points.Get(to_clip.p0)};
+    input[1] = {to_clip.p1, this->points.Get(to_clip.p1)};
+    input[2] = {to_clip.p2, this->points.Get(to_clip.p2)};
+
+    int point_count = this->outcodes.size();    // Points after this were made by clipping, and have no outcode
+    for (int plane = 0; plane < plane_count && input_count >= 3; ++plane)
+    {
+        uint8_t bit = uint8_t(1 << plane);
+        if ((crossed & bit) == 0)
+        {
+            continue;   // No corner of the triangle is outside this plane
+        }
 
-    bool clipped = false;
+        for (int i = 0; i < input_count; ++i)
+        {
+            if (input[i].index < point_count)
+            {
+                inside[i] = (this->outcodes[input[i].index] & bit) == 0;
+            } else {
+                inside[i] = planes[plane]->SignedDistance(input[i].point) >= 0;
+            }
+        }
 
-    // Iterate through the triangle list
-    for (std::vector<Triangle>::iterator iterator = this->triangles.begin(); iterator != this->triangles.end(); iterator++)
-    {
-        Triangle to_clip = *iterator;
+        // Keep the corners inside the plane, and add a corner wherever an edge crosses it. A convex
+        // polygon is crossed at most twice, so it gains at most one corner. Only a polygon bent out
+        // of shape by rounding could gain more, and running out of room would leave a crack.
+        output_count = 0;
+        for (int i = 0; i < input_count; ++i)
+        {
+            int next = (i + 1 == input_count) ? 0 : i + 1;
+            if (inside[i])
+            {
+                assert(output_count < capacity);
+                output[output_count++] = input[i];
+            }
+            if (inside[i] != inside[next])
+            {
+                assert(output_count < capacity);
+                // The triangle on the other side of this edge gets the same point
+                int crossing = inside[i] ? this->CutEdgeAt(input[i].index, input[next].index, planes[plane], plane)
+                    : this->CutEdgeAt(input[next].index, input[i].index, planes[plane], plane);
+                output[output_count++] = {crossing, this->points.Get(crossing)};
+            }
+        }
+
+        std::swap(input, output);
+        input_count = output_count;
+    }
 
-        // Clip against plane, possibly adding new triangles to our buffer list
-        clipped = this->ClipTriangle(to_clip, plane);
-        if (clipped)
+    // Split the polygon into triangles that share its flattest corner
+    int center = 0;
+    float flattest = 2;
+    for (int i = 0; i < input_count && input_count > 3; ++i)
+    {
+        HomCoordinates to_previous = input[(i + input_count - 1) % input_count].point - input[i].point;
+        HomCoordinates to_next = input[(i + 1) % input_count].point - input[i].point;
+        float length = std::sqrt(HomCoordinates::DotProduct(to_previous, to_previous) * HomCoordinates::DotProduct(to_next, to_next));
+        float cosine = (length > 0) ? HomCoordinates::DotProduct(to_previous, to_next) / length : 2;
+        if (cosine < flattest)
         {
-            this->triangles.erase(iterator);
-            iterator--;
+            flattest = cosine;
+            center = i;
         }
     }
+    for (int i = 1; i + 1 < input_count; ++i)
+    {
+        this->clipped_tris.push_back({input[center].index, input[(center + i) % input_count].index,
+            input[(center + i + 1) % input_count].index, to_clip.color});
+    }
+}
 
-    // Add new triangles and points
-    
-    for (HomCoordinates point : new_points)
+int RenderableModelInstance::CutEdgeAt(int inside_index, int outside_index, Plane * plane, int plane_index)
+{
+    // Keep the table at most half full, so that looking up an edge only checks a few entries
+    if (2 * (this->cut_edge_count + 1) > int(this->cut_edges.size()))
     {
-        // std::cout << "\t" << point.data[0] << ", " << point.data[1] << ", " << point.data[2] << std::endl;
-        this->points.push_back(point);
-        
+        std::vector<CutEdge> old_edges(std::max(size_t(64), 2 * this->cut_edges.size()), CutEdge{0, 0, 0, -1});
+        old_edges.swap(this->cut_edges);
+        for (const CutEdge& edge : old_edges)
+        {
+            if (edge.crossing >= 0)
+            {
+                this->cut_edges[this->FindCutEdge(edge.low, edge.high, edge.plane)] = edge;
+            }
+        }
     }
 
-    Triangle last;
-    for (Triangle triangle : new_tris)
+    int low = std::min(inside_index, outside_index);
+    int high = std::max(inside_index, outside_index);
+    CutEdge& edge = this->cut_edges[this->FindCutEdge(low, high, plane_index)];
+    if (edge.crossing < 0)
     {
-        this->triangles.push_back(triangle);
-        last = this->triangles[ (this->triangles.size() - 1) ];
+        // First time this plane cuts this edge. Always measure from the inside point, so the point
+        // does not depend on which of the triangles sharing the edge gets here first.
+        edge = {low, high, plane_index, this->points.Size()};
+        this->cut_edge_count++;
+        this->points.PushBack(plane->Intersection(this->points.Get(inside_index), this->points.Get(outside_index)));
     }
+    return edge.crossing;
 }
 
-/*
- * Clips a triangle based on a plane. If the triangle gets clipped, the new triangles (if any) will
- * be added to the new_tris and new_points buffer lists, and the function will return true
- */
-bool RenderableModelInstance::ClipTriangle(Triangle to_clip, Plane * plane)
+size_t RenderableModelInstance::FindCutEdge(int low, int high, int plane_index) const
 {
-    bool clipped = true;
-    bool normal_flipped = false;    // Used to determine if we flip the normal when we sort the points.
-                                    // Every time we swap points, it is like we are reflecting the triangle, therefore flipping the normal.
-
-    // Get triangle and points we are clipping
-	HomCoordinates p0, p1, p2;
-	p0 = this->points[to_clip.p0];
-	p1 = this->points[to_clip.p1];
-	p2 = this->points[to_clip.p2];
-
-    // Get distances from points to planes
-	float dist[3];
-	dist[0] = plane->SignedDistance(p0);
-	dist[1] = plane->SignedDistance(p1);
-	dist[2] = plane->SignedDistance(p2);
-
-	// Sort the points by distance
-	float temp;
-    HomCoordinates temp_coord;
-    int temp_idx;
-    if (dist[0] > dist[1])
-	{
-		temp = dist[0];
-		dist[0] = dist[1];
-		dist[1] = temp;
-        temp_coord = p0;
-        p0 = p1;
-        p1 = temp_coord;
-        temp_idx = to_clip.p0;
-        to_clip.p0 = to_clip.p1;
-        to_clip.p1 = temp_idx;
-        normal_flipped = !normal_flipped;
-	}
-	if (dist[0] > dist[2])
-	{
-		temp = dist[0];
-		dist[0] = dist[2];
-		dist[2] = temp;
-        temp_coord = p0;
-        p0 = p2;
-        p2 = temp_coord;
-        temp_idx = to_clip.p0;
-        to_clip.p0 = to_clip.p2;
-        to_clip.p2 = temp_idx;
-        normal_flipped = !normal_flipped;
-	}
-	if (dist[1] > dist[2])
-	{
-		temp = dist[1];
-		dist[1] = dist[2];
-		dist[2] = temp;
-        temp_coord = p1;
-        p1 = p2;
-        p2 = temp_coord;
-        temp_idx = to_clip.p1;
-        to_clip.p1 = to_clip.p2;
-        to_clip.p2 = temp_idx;
-        normal_flipped = !normal_flipped;
-	}
-
-
-	if (dist[0] > 0)	// Smallest distance is positive
-	{
-		// Triangle is entirely in bounds!! yay <3
-		// The triangle will be part of the list!
-        clipped = false;
-
-	} else if (dist[2] < 0)	// Largest distance is negative
-	{
-		// Triangle is entirely out of bounds... not yay </3
-        // Triangle will be erased in ClipTrianglesAgainstPlane function
-	} else if (dist[1] < 0)	// Only 1 value is positive (the largest)
-	{
-
-        /*let A be the vertex with a positive distance
-        compute B' = Intersection(AB, plane)
-        compute C' = Intersection(AC, plane)
-        return [Triangle(A, B', C')]*/
-
-        // HomCoordinates * pA = &p2;
-        HomCoordinates pB_prime = plane->Intersection(p2, p1);
-        HomCoordinates pC_prime = plane->Intersection(p2, p0);
-        this->new_points.push_back(pB_prime);
-        this->new_points.push_back(pC_prime);
-
-        // Create triangle with same color, with 2 new points (B and C), and p2 from the original triangle (A)
-        Triangle new_tri;
-        if (normal_flipped) 
+    // Linear probing from the edge's hash (the table size is a power of 2)
+    size_t mask = this->cut_edges.size() - 1;
+    size_t slot = (uint32_t(low) * 0x9E3779B1u ^ uint32_t(high) * 0x85EBCA6Bu ^ uint32_t(plane_index)) & mask;
+    while (this->cut_edges[slot].crossing >= 0)
+    {
+        const CutEdge& edge = this->cut_edges[slot];
+        if (edge.low == low && edge.high == high && edge.plane == plane_index)
         {
-            new_tri = {this->new_point_start_index, this->new_point_start_index + 1, to_clip.p2, to_clip.color};
-        } else {
-            new_tri = {this->new_point_start_index + 1, this->new_point_start_index, to_clip.p2, to_clip.color};
+            break;
         }
-        this->new_point_start_index += 2;
-        this->new_tris.push_back(new_tri);
-
-	} else { // Only 1 value is negative (the smallest)
-        /*
-        let C be the vertex with a negative distance
-        compute A' = Intersection(AC, plane)
-        compute B' = Intersection(BC, plane)
-        return [Triangle(A, B, A'), Triangle(A', B, B')]
-        */
-       HomCoordinates * pC = &p0;
-       HomCoordinates * pB = &p1;
-       HomCoordinates * pA = &p2;
-       HomCoordinates pA_prime = plane->Intersection(*pA, *pC);
-       HomCoordinates pB_prime = plane->Intersection(*pB, *pC);
-       this->new_points.push_back(pA_prime);
-       this->new_points.push_back(pB_prime);
-
-       Triangle new_tri0, new_tri1;
-       if (normal_flipped)
-       {
-            new_tri0 = {to_clip.p2, to_clip.p1, this->new_point_start_index, to_clip.color};
-            new_tri1 = {this->new_point_start_index, to_clip.p1, this->new_point_start_index + 1, to_clip.color};
-       } else {
-            new_tri0 = {to_clip.p1, to_clip.p2, this->new_point_start_index, to_clip.color};
-            new_tri1 = {to_clip.p1, this->new_point_start_index, this->new_point_start_index + 1, to_clip.color};
-       }
-       this->new_tris.push_back(new_tri0);
-       this->new_tris.push_back(new_tri1);
-       this->new_point_start_index += 2;
-	}
-    
-    return clipped;
-
-}
\ No newline at end of file
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
@@ -0,0 +1,57 @@
+/* graphics_multisample.cpp
+ *
+ * GraphicsManager functions for multisample anti-aliasing. The sample buffer is described in
+ * graphics_multisample.h, and the multisampled triangle kernel is in graphics_rasterizer.cpp.
+ *
+ * @author Alex Wills
+ * @date May 24, 2023
+ */
+
+#include "../lib/graphics.h"
+#include <algorithm>
+
+void GraphicsManager::SetMultisampling(int samples)
+{
+	if (samples != 1 && samples != 4 && samples != 8)
+	{
+		std::cout << "!!WARNING: Multisampling supports 1, 4, or 8 samples per pixel, not " << samples << ". Turning it off." << std::endl;
+		samples = 1;
+	}
+	this->sample_count = samples;
+	if (this->canvas_width > 0)
+	{
+		this->sample_buffer = SampleBuffer(this->canvas_width, this->canvas_height, samples);
+	}
+	std::cout << "~ Drawing depth tested triangles with " << samples << " sample(s) per pixel" << std::endl;
+}
+
+void GraphicsManager::ResolveSamples()
+{
+	// Split the rows into bands across the render threads; every pixel is written by one thread
+	const int band_height = TileBinner::tile_size;
+	int num_bands = (this->canvas_height + band_height - 1) / band_height;
+	this->render_threads.Run(num_bands, [this, band_height](int band, int thread_index)
+	{
+		uint32_t* row_pixels;
+		int last_row = std::min((band + 1) * band_height, this->canvas_height);
+		for (int row = band * band_height; row < last_row; ++row)
+		{
+			row_pixels = this->frame_buffer.GetRow(row);
+			for (int column = 0; column < this->canvas_width; ++column)
+			{
+				switch (this->sample_buffer.GetState(row, column))
+				{
+					case SampleBuffer::UNIFORM:
+						row_pixels[this->frame_buffer.ColumnOffset(column)] = *this->sample_buffer.GetColors(row, column);
+						break;
+					case SampleBuffer::MIXED:
+						row_pixels[this->frame_buffer.ColumnOffset(column)] = this->sample_buffer.Average(row, column);
+						break;
+					default:
+						// Untouched: keep whatever was drawn to the frame buffer
+						break;
+				}
+			}
+		}
+	});
+}
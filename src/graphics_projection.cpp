@@ -8,6 +8,8 @@
  */
 
 #include "../lib/graphics.h"
+#include <algorithm>
+#include <cmath>
 
 
 /*
@@ -49,3 +51,61 @@ Point2D Camera::ProjectVertex(HomCoordinates vertex)
     Point3D p_vertex = {vertex[0], vertex[1], vertex[2]};
     return this->ProjectVertex(p_vertex);
 }
+
+/*
+ * Converts a point from 3D space to canvas space with sub-pixel precision.
+ *
+ * @param vertex - the 3D point to render (in camera space)
+ * @return the point on the canvas in 28.4 fixed point
+ */
+SubPixelPoint Camera::ProjectVertexSubPixel(HomCoordinates vertex)
+{
+    float canvas_x = vertex[0] * this->viewport_distance / vertex[2] * this->canvas_width / this->viewport_width;
+    float canvas_y = vertex[1] * this->viewport_distance / vertex[2] * this->canvas_height / this->viewport_height;
+
+    // Keep far off-screen points (from vertices very close to the camera plane) in range,
+    // so the edge function products in the rasterizer cannot overflow
+    const float limit = float(1 << 26);
+    canvas_x = clamp(canvas_x * SUBPIXEL_SCALE, -limit, limit);
+    canvas_y = clamp(canvas_y * SUBPIXEL_SCALE, -limit, limit);
+
+    return SubPixelPoint{int(std::lround(canvas_x)), int(std::lround(canvas_y))};
+}
+
+/*
+ * Projects every point of a VertexStream with the same math as ProjectVertexSubPixel.
+ * The floating point part runs over whole blocks of the padded stream, which the compiler
+ * can vectorize; only the rounding to fixed point is done one point at a time.
+ */
+void Camera::ProjectVertexStream(const VertexStream& points, SubPixelPoint* projected)
+{
+    const float* x = points.X();
+    const float* y = points.Y();
+    const float* z = points.Z();
+    const float viewport_distance = this->viewport_distance;
+    const float canvas_width = this->canvas_width, canvas_height = this->canvas_height;
+    const float viewport_width = this->viewport_width, viewport_height = this->viewport_height;
+    const float limit = float(1 << 26);
+    const int count = points.Size();
+
+    float canvas_x[VertexStream::lane_count];
+    float canvas_y[VertexStream::lane_count];
+    int block_end;
+    for (int start = 0; start < count; start += VertexStream::lane_count)
+    {
+        // Padding points can divide by 0, but their results are never used
+        for (int i = 0; i < VertexStream::lane_count; ++i)
+        {
+            canvas_x[i] = x[start + i] * viewport_distance / z[start + i] * canvas_width / viewport_width;
+            canvas_y[i] = y[start + i] * viewport_distance / z[start + i] * canvas_height / viewport_height;
+            canvas_x[i] = std::min(std::max(canvas_x[i] * SUBPIXEL_SCALE, -limit), limit);
+            canvas_y[i] = std::min(std::max(canvas_y[i] * SUBPIXEL_SCALE, -limit), limit);
+        }
+
+        block_end = std::min(int(VertexStream::lane_count), count - start);
+        for (int i = 0; i < block_end; ++i)
+        {
+            projected[start + i] = SubPixelPoint{int(std::lround(canvas_x[i])), int(std::lround(canvas_y[i]))};
+        }
+    }
+}
@@ -0,0 +1,836 @@
+/* graphics_rasterizer.cpp
+ *
+ * The edge function (half-space) triangle rasterizer shared by the flat, gradient,
+ * and depth triangle functions. See graphics_raster.h for an overview.
+ *
+ * @author Alex Wills
+ * @date May 9, 2023
+ */
+
+#include "../lib/graphics.h"
+#include <algorithm>
+#include <climits>
+
+// Pick the widest vector instructions the compiler was allowed to use.
+// SSE2 is part of every x86-64 CPU, AVX2 needs -mavx2 (or -march=native).
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RASTER_SIMD_WIDTH 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RASTER_SIMD_WIDTH 4
+#endif
+
+/*
+ * Returns the whole canvas as a rectangle in buffer space.
+ */
+ScreenRect GraphicsManager::GetScreenRect()
+{
+	return ScreenRect{0, 0, this->canvas_width - 1, this->canvas_height - 1};
+}
+
+/*
+ * Computes the edge functions and clipped bounding box of a triangle.
+ *
+ * @param p0, p1, p2 - the points of the triangle in 28.4 fixed point (0, 0 is the center of the screen)
+ * @param setup - the setup to fill in
+ * @param margin - pixels to grow the bounding box by on every side
+ * @return false if the triangle has no area or covers no pixels on the screen
+ */
+bool GraphicsManager::SetupTriangle(SubPixelPoint p0, SubPixelPoint p1, SubPixelPoint p2, TriangleSetup& setup, int margin)
+{
+	// Move the points into buffer space (y points down), still in sub-pixel units
+	int64_t column0 = int64_t(this->max_screen_x) * SUBPIXEL_SCALE;
+	int64_t row0 = int64_t(this->max_screen_y) * SUBPIXEL_SCALE;
+	int64_t xs[3] = {column0 + p0.x, column0 + p1.x, column0 + p2.x};
+	int64_t ys[3] = {row0 - p0.y, row0 - p1.y, row0 - p2.y};
+
+	// Edge i goes from vertex j to vertex k, opposite vertex i
+	int j, k;
+	for (int i = 0; i < 3; ++i)
+	{
+		j = (i + 1) % 3;
+		k = (i + 2) % 3;
+		setup.edges[i].a = ys[j] - ys[k];
+		setup.edges[i].b = xs[k] - xs[j];
+		setup.edges[i].c = xs[j] * ys[k] - xs[k] * ys[j];
+	}
+
+	// Every edge function equals twice the signed area at its opposite vertex
+	setup.double_area = setup.edges[0].a * xs[0] + setup.edges[0].b * ys[0] + setup.edges[0].c;
+	if (setup.double_area == 0)
+	{
+		// Degenerate triangle, nothing to fill
+		return false;
+	}
+	if (setup.double_area < 0)
+	{
+		// Flip the edges so that the inside of the triangle is always positive
+		for (int i = 0; i < 3; ++i)
+		{
+			setup.edges[i].a = -setup.edges[i].a;
+			setup.edges[i].b = -setup.edges[i].b;
+			setup.edges[i].c = -setup.edges[i].c;
+		}
+		setup.double_area = -setup.double_area;
+	}
+
+	for (int i = 0; i < 3; ++i)
+	{
+		// Top-left rule: a pixel exactly on an edge (E == 0) is only inside if the edge is a
+		// left edge (E grows to the right) or a top edge (horizontal, E grows downwards).
+		// E is an integer, so subtracting 1 turns E >= 0 into E > 0 for the other edges.
+		if (!(setup.edges[i].a > 0 || (setup.edges[i].a == 0 && setup.edges[i].b > 0)))
+		{
+			setup.edges[i].c -= 1;
+		}
+
+		// Sample pixels at their integer coordinates: one pixel is SUBPIXEL_SCALE sub-pixel steps
+		setup.edges[i].a *= SUBPIXEL_SCALE;
+		setup.edges[i].b *= SUBPIXEL_SCALE;
+	}
+
+	setup.vertex_x = int(xs[0]);
+	setup.vertex_y = int(ys[0]);
+	setup.origin_x = int((xs[0] + SUBPIXEL_SCALE / 2) >> SUBPIXEL_BITS);
+	setup.origin_y = int((ys[0] + SUBPIXEL_SCALE / 2) >> SUBPIXEL_BITS);
+
+	// Bounding box of the pixels whose sample points can be inside, clipped to the screen
+	// (the shifts round towards negative infinity, so off-screen points round correctly)
+	const int64_t round_up = SUBPIXEL_SCALE - 1;
+	ScreenRect screen = this->GetScreenRect();
+	setup.bounds.min_x = int(std::max(((std::min({xs[0], xs[1], xs[2]}) + round_up) >> SUBPIXEL_BITS) - margin, int64_t(screen.min_x)));
+	setup.bounds.max_x = int(std::min((std::max({xs[0], xs[1], xs[2]}) >> SUBPIXEL_BITS) + margin, int64_t(screen.max_x)));
+	setup.bounds.min_y = int(std::max(((std::min({ys[0], ys[1], ys[2]}) + round_up) >> SUBPIXEL_BITS) - margin, int64_t(screen.min_y)));
+	setup.bounds.max_y = int(std::min((std::max({ys[0], ys[1], ys[2]}) >> SUBPIXEL_BITS) + margin, int64_t(screen.max_y)));
+
+	return setup.bounds.min_x <= setup.bounds.max_x && setup.bounds.min_y <= setup.bounds.max_y;
+}
+
+/*
+ * Computes the plane equation for a value given at each vertex of a triangle.
+ * SetupTriangle must be called first.
+ *
+ * @param v0, v1, v2 - the value at each vertex of the triangle
+ */
+void GraphicsManager::SetupAttributePlane(TriangleSetup& setup, float v0, float v1, float v2)
+{
+	// The value is a blend of the vertex values, weighted by the edge functions (barycentric coordinates)
+	double area = double(setup.double_area);
+	double dx = (double(v0) * setup.edges[0].a + double(v1) * setup.edges[1].a + double(v2) * setup.edges[2].a) / area;
+	double dy = (double(v0) * setup.edges[0].b + double(v1) * setup.edges[1].b + double(v2) * setup.edges[2].b) / area;
+	setup.attribute.dx = float(dx);
+	setup.attribute.dy = float(dy);
+
+	// The plane starts at the pixel nearest vertex 0, so step from the vertex to that pixel
+	double offset_x = double(setup.origin_x * SUBPIXEL_SCALE - setup.vertex_x) / SUBPIXEL_SCALE;
+	double offset_y = double(setup.origin_y * SUBPIXEL_SCALE - setup.vertex_y) / SUBPIXEL_SCALE;
+	setup.attribute.base = float(v0 + dx * offset_x + dy * offset_y);
+	setup.attribute.origin_x = setup.origin_x;
+	setup.attribute.origin_y = setup.origin_y;
+}
+
+/*
+ * Visits every pixel of a triangle inside [min_x, max_x] x [min_y, max_y] with incremental
+ * edge functions, and calls shade(row_pixels, x, y, row_start) for the pixels that are covered.
+ * Pixel x of the row is row_pixels[frame_buffer.ColumnOffset(x)].
+ */
+template <typename ShadeFunction>
+static void TraverseTriangle(const TriangleSetup& setup, FrameBuffer& frame_buffer,
+	int min_x, int max_x, int min_y, int max_y, ShadeFunction shade)
+{
+	const EdgeFunction& edge0 = setup.edges[0];
+	const EdgeFunction& edge1 = setup.edges[1];
+	const EdgeFunction& edge2 = setup.edges[2];
+
+	int64_t w0, w1, w2;	// Edge function values at the current pixel
+	float row_start;	// Attribute value at the start of the row
+	uint32_t* row_pixels;
+
+	for (int y = min_y; y <= max_y; ++y)
+	{
+		w0 = edge0.At(min_x, y);
+		w1 = edge1.At(min_x, y);
+		w2 = edge2.At(min_x, y);
+		row_start = setup.attribute.RowStart(y);
+		row_pixels = frame_buffer.GetRow(y);
+
+		for (int x = min_x; x <= max_x; ++x)
+		{
+			// The pixel is inside if no edge function is negative
+			if ((w0 | w1 | w2) >= 0)
+			{
+				shade(row_pixels, x, y, row_start);
+			}
+
+			// Step one pixel to the right
+			w0 += edge0.a;
+			w1 += edge1.a;
+			w2 += edge2.a;
+		}
+	}
+}
+
+/*
+ * Finds the nearest and farthest 1/z of a triangle's depth plane over the pixels
+ * [min_x, max_x] x [min_y, max_y]. The plane is evaluated with the same float math as the
+ * kernels, which only ever moves one way along a row and along a column (rounding never
+ * reverses it), so the corners of the rectangle hold the extremes exactly.
+ */
+static void DepthExtremes(const AttributePlane& plane, int min_x, int max_x, int min_y, int max_y,
+	float& nearest, float& farthest)
+{
+	float top = plane.RowStart(min_y);
+	float bottom = plane.RowStart(max_y);
+	float corners[4] = {plane.AlongRow(top, min_x), plane.AlongRow(top, max_x),
+		plane.AlongRow(bottom, min_x), plane.AlongRow(bottom, max_x)};
+	nearest = std::max({corners[0], corners[1], corners[2], corners[3]});
+	farthest = std::min({corners[0], corners[1], corners[2], corners[3]});
+}
+
+/*
+ * How far the sample points of a pixel can move each edge function and the depth plane away
+ * from their values at the pixel's center (all 0 when only the center is sampled), and whether
+ * the samples' depths can be compared with the depth buffer's HiZ level.
+ */
+struct SampleSpread {
+	int64_t edges[3];
+	float depth;
+	bool use_hiz;
+};
+static const SampleSpread center_sample = {{0, 0, 0}, 0.0f, true};
+
+/*
+ * Splits the part of a depth tested triangle inside [min_x, max_x] x [min_y, max_y] into the
+ * depth buffer's HiZ blocks, and calls draw(x0, x1, y0, y1) with the part of each block that
+ * the triangle could change. Blocks that are outside an edge of the triangle are skipped, and
+ * so are blocks where the triangle is no closer than the farthest depth already in the block.
+ * When the triangle covers a whole block, the block's farthest depth is raised afterwards.
+ * PrepareRect() must have been called on the rectangle.
+ */
+template <typename DrawFunction>
+static void ForEachDepthBlock(const TriangleSetup& setup, DepthBuffer& depth_buffer,
+	int min_x, int max_x, int min_y, int max_y, const SampleSpread& spread, DrawFunction draw)
+{
+	const int size = DepthBuffer::block_size;
+	int x0, x1, y0, y1;
+	int64_t value, lowest, highest;
+	bool outside, inside;
+	float nearest, farthest;
+
+	for (int block_y = min_y / size; block_y <= max_y / size; ++block_y)
+	{
+		y0 = std::max(block_y * size, min_y);
+		y1 = std::min(block_y * size + size - 1, max_y);
+		for (int block_x = min_x / size; block_x <= max_x / size; ++block_x)
+		{
+			x0 = std::max(block_x * size, min_x);
+			x1 = std::min(block_x * size + size - 1, max_x);
+
+			// Edge functions are linear, so they are lowest and highest at corners of the block
+			outside = false;
+			inside = true;
+			for (int i = 0; i < 3; ++i)
+			{
+				const EdgeFunction& edge = setup.edges[i];
+				value = edge.At(x0, y0);
+				lowest = value + std::min(edge.a, int64_t(0)) * (x1 - x0) + std::min(edge.b, int64_t(0)) * (y1 - y0);
+				highest = value + std::max(edge.a, int64_t(0)) * (x1 - x0) + std::max(edge.b, int64_t(0)) * (y1 - y0);
+				outside = outside || highest + spread.edges[i] < 0;
+				inside = inside && lowest - spread.edges[i] >= 0;
+			}
+			if (outside)
+			{
+				continue;
+			}
+
+			// Every pixel would fail the depth test if the triangle is not closer than the whole block
+			// (float addition never reverses an order, so the spread keeps the bounds exact)
+			DepthExtremes(setup.attribute, x0, x1, y0, y1, nearest, farthest);
+			nearest = nearest + spread.depth;
+			farthest = farthest - spread.depth;
+			if (spread.use_hiz && depth_buffer.ToStored(nearest) <= depth_buffer.GetFarthest(block_x, block_y))
+			{
+				continue;
+			}
+
+			draw(x0, x1, y0, y1);
+
+			// Each pixel now holds the triangle's depth or something closer
+			if (spread.use_hiz && inside && depth_buffer.CoversBlock(block_x, block_y, x0, x1, y0, y1))
+			{
+				depth_buffer.RaiseFarthest(block_x, block_y, depth_buffer.ToStored(farthest));
+			}
+		}
+	}
+}
+
+#ifdef RASTER_SIMD_WIDTH
+/*
+ * Thin wrappers around the SSE2/AVX2 intrinsics, so that the block kernel below
+ * is written once for both vector widths. VecInt holds RASTER_SIMD_WIDTH 32-bit
+ * integers (or masks), VecFloat holds RASTER_SIMD_WIDTH floats.
+ */
+#if RASTER_SIMD_WIDTH == 8
+typedef __m256i VecInt;
+typedef __m256 VecFloat;
+static inline VecInt IntSet(int v) { return _mm256_set1_epi32(v); }
+static inline VecInt IntLanes(int step) { return _mm256_setr_epi32(0, step, 2 * step, 3 * step, 4 * step, 5 * step, 6 * step, 7 * step); }
+static inline VecInt IntAdd(VecInt a, VecInt b) { return _mm256_add_epi32(a, b); }
+static inline VecInt IntSub(VecInt a, VecInt b) { return _mm256_sub_epi32(a, b); }
+static inline VecInt MaskAnd(VecInt a, VecInt b) { return _mm256_and_si256(a, b); }
+static inline VecInt IntOr(VecInt a, VecInt b) { return _mm256_or_si256(a, b); }
+static inline VecInt IntGreater(VecInt a, VecInt b) { return _mm256_cmpgt_epi32(a, b); }
+static inline VecFloat FloatSet(float v) { return _mm256_set1_ps(v); }
+static inline VecFloat ToFloat(VecInt a) { return _mm256_cvtepi32_ps(a); }
+static inline VecFloat FloatAdd(VecFloat a, VecFloat b) { return _mm256_add_ps(a, b); }
+static inline VecFloat FloatMul(VecFloat a, VecFloat b) { return _mm256_mul_ps(a, b); }
+static inline VecInt FloatGreater(VecFloat a, VecFloat b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+static inline VecFloat LoadFloats(const float* p) { return _mm256_loadu_ps(p); }
+static inline void StoreFloats(float* p, VecFloat v) { _mm256_storeu_ps(p, v); }
+static inline VecInt LoadInts(const uint32_t* p) { return _mm256_loadu_si256((const __m256i*) p); }
+static inline void StoreInts(uint32_t* p, VecInt v) { _mm256_storeu_si256((__m256i*) p, v); }
+static inline VecInt SelectInts(VecInt mask, VecInt a, VecInt b) { return _mm256_blendv_epi8(b, a, mask); }
+static inline VecFloat SelectFloats(VecInt mask, VecFloat a, VecFloat b) { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask)); }
+static inline bool AnyLane(VecInt mask) { return _mm256_movemask_epi8(mask) != 0; }
+static inline VecFloat FloatMin(VecFloat a, VecFloat b) { return _mm256_min_ps(a, b); }
+static inline VecFloat FloatMax(VecFloat a, VecFloat b) { return _mm256_max_ps(a, b); }
+static inline VecInt TruncateToInt(VecFloat a) { return _mm256_cvttps_epi32(a); }
+static inline VecInt LoadShorts(const uint16_t* p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) p)); }
+static inline void StoreShorts(uint16_t* p, VecInt v)
+{
+	_mm_storeu_si128((__m128i*) p, _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+#else
+typedef __m128i VecInt;
+typedef __m128 VecFloat;
+static inline VecInt IntSet(int v) { return _mm_set1_epi32(v); }
+static inline VecInt IntLanes(int step) { return _mm_setr_epi32(0, step, 2 * step, 3 * step); }
+static inline VecInt IntAdd(VecInt a, VecInt b) { return _mm_add_epi32(a, b); }
+static inline VecInt IntSub(VecInt a, VecInt b) { return _mm_sub_epi32(a, b); }
+static inline VecInt MaskAnd(VecInt a, VecInt b) { return _mm_and_si128(a, b); }
+static inline VecInt IntOr(VecInt a, VecInt b) { return _mm_or_si128(a, b); }
+static inline VecInt IntGreater(VecInt a, VecInt b) { return _mm_cmpgt_epi32(a, b); }
+static inline VecFloat FloatSet(float v) { return _mm_set1_ps(v); }
+static inline VecFloat ToFloat(VecInt a) { return _mm_cvtepi32_ps(a); }
+static inline VecFloat FloatAdd(VecFloat a, VecFloat b) { return _mm_add_ps(a, b); }
+static inline VecFloat FloatMul(VecFloat a, VecFloat b) { return _mm_mul_ps(a, b); }
+static inline VecInt FloatGreater(VecFloat a, VecFloat b) { return _mm_castps_si128(_mm_cmpgt_ps(a, b)); }
+static inline VecFloat LoadFloats(const float* p) { return _mm_loadu_ps(p); }
+static inline void StoreFloats(float* p, VecFloat v) { _mm_storeu_ps(p, v); }
+static inline VecInt LoadInts(const uint32_t* p) { return _mm_loadu_si128((const __m128i*) p); }
+static inline void StoreInts(uint32_t* p, VecInt v) { _mm_storeu_si128((__m128i*) p, v); }
+static inline VecInt SelectInts(VecInt mask, VecInt a, VecInt b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+static inline VecFloat SelectFloats(VecInt mask, VecFloat a, VecFloat b)
+{
+	__m128 float_mask = _mm_castsi128_ps(mask);
+	return _mm_or_ps(_mm_and_ps(float_mask, a), _mm_andnot_ps(float_mask, b));
+}
+static inline bool AnyLane(VecInt mask) { return _mm_movemask_epi8(mask) != 0; }
+static inline VecFloat FloatMin(VecFloat a, VecFloat b) { return _mm_min_ps(a, b); }
+static inline VecFloat FloatMax(VecFloat a, VecFloat b) { return _mm_max_ps(a, b); }
+static inline VecInt TruncateToInt(VecFloat a) { return _mm_cvttps_epi32(a); }
+static inline VecInt LoadShorts(const uint16_t* p) { return _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*) p), _mm_setzero_si128()); }
+static inline void StoreShorts(uint16_t* p, VecInt v)
+{
+	// SSE2 can only pack with signed saturation, so shift [0, 65535] down to the signed range and back
+	__m128i shifted = _mm_sub_epi32(v, _mm_set1_epi32(32768));
+	__m128i packed = _mm_packs_epi32(shifted, shifted);
+	_mm_storel_epi64((__m128i*) p, _mm_xor_si128(packed, _mm_set1_epi16(short(0x8000))));
+}
+#endif
+
+/*
+ * Returns true if every edge function fits in a 32-bit integer everywhere the block kernel
+ * will step it: from block_min_x to the end of the last block, on rows [min_y, max_y].
+ * Edge functions are linear, so checking the corners is enough.
+ */
+static bool EdgesFitInt32(const TriangleSetup& setup, int block_min_x, int block_max_x, int min_y, int max_y)
+{
+	int64_t value;
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int x : {block_min_x, block_max_x})
+		{
+			for (int y : {min_y, max_y})
+			{
+				value = setup.edges[i].At(x, y);
+				if (value > INT_MAX || value < INT_MIN)
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+#endif
+
+/*
+ * How each DepthFormat turns an interpolated 1/z into a stored value, and how stored values
+ * are loaded, compared, and written, one at a time and RASTER_SIMD_WIDTH at a time.
+ * The depth kernels below are templates over these, so there is one kernel for every format.
+ * The fixed point formats clamp the scaled depth and truncate it, with the same float math
+ * in the scalar and SIMD versions so that both give the same results.
+ */
+struct FloatDepth {
+	typedef float Stored;
+	static float Quantize(float z_value, float scale, float fixed_max) { return z_value; }
+#ifdef RASTER_SIMD_WIDTH
+	typedef VecFloat Vec;
+	static VecFloat Quantize(VecFloat z_values, VecFloat scale, VecFloat fixed_max) { return z_values; }
+	static VecFloat Load(const float* p) { return LoadFloats(p); }
+	static void Store(float* p, VecFloat v) { StoreFloats(p, v); }
+	static VecInt Greater(VecFloat a, VecFloat b) { return FloatGreater(a, b); }
+	static VecFloat Select(VecInt mask, VecFloat a, VecFloat b) { return SelectFloats(mask, a, b); }
+#endif
+};
+
+template <typename T>
+struct FixedDepth {
+	typedef T Stored;
+	static T Quantize(float z_value, float scale, float fixed_max)
+	{
+		return T(std::min(std::max(z_value * scale, 0.0f), fixed_max));
+	}
+#ifdef RASTER_SIMD_WIDTH
+	typedef VecInt Vec;
+	static VecInt Quantize(VecFloat z_values, VecFloat scale, VecFloat fixed_max)
+	{
+		return TruncateToInt(FloatMin(FloatMax(FloatMul(z_values, scale), FloatSet(0)), fixed_max));
+	}
+	static VecInt Load(const uint16_t* p) { return LoadShorts(p); }
+	static VecInt Load(const uint32_t* p) { return LoadInts(p); }
+	static void Store(uint16_t* p, VecInt v) { StoreShorts(p, v); }
+	static void Store(uint32_t* p, VecInt v) { StoreInts(p, v); }
+	static VecInt Greater(VecInt a, VecInt b) { return IntGreater(a, b); }	// Values fit in 24 bits, so signed compares work
+	static VecInt Select(VecInt mask, VecInt a, VecInt b) { return SelectInts(mask, a, b); }
+#endif
+};
+
+typedef FixedDepth<uint16_t> Fixed16Depth;
+typedef FixedDepth<uint32_t> Fixed24Depth;
+
+/*
+ * Depth tested triangle kernel that processes RASTER_SIMD_WIDTH pixels of a row at once.
+ * For each block it evaluates coverage from the edge functions, interpolates 1/z, tests
+ * and writes depth, and writes the color to the pixels that passed, all with masks.
+ * Blocks are aligned to multiples of RASTER_SIMD_WIDTH columns, which the padded rows of
+ * the FrameBuffer and DepthBuffer always contain. The triangle is walked one HiZ block
+ * at a time (see ForEachDepthBlock), so hidden and empty blocks are skipped.
+ *
+ * @return false if the triangle could not use the kernel (no SIMD support, or the edge
+ *   functions do not fit in 32-bit lanes), in which case nothing was drawn
+ */
+template <typename Depth>
+static bool DepthBlockKernel(const TriangleSetup& setup, FrameBuffer& frame_buffer, DepthBuffer& depth_buffer,
+	int min_x, int max_x, int min_y, int max_y)
+{
+#ifdef RASTER_SIMD_WIDTH
+	typedef typename Depth::Stored Stored;
+	typedef typename Depth::Vec Vec;
+
+	const int width = RASTER_SIMD_WIDTH;
+	int block_min_x = min_x / width * width;	// min_x is never negative
+	int block_max_x = max_x / width * width + width - 1;
+	if (!EdgesFitInt32(setup, block_min_x, block_max_x, min_y, max_y))
+	{
+		return false;
+	}
+
+	// Per-lane offsets, per-block steps, and per-row steps for each edge function
+	VecInt edge_lanes[3], edge_steps[3], edge_row_steps[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		edge_lanes[i] = IntLanes(int(setup.edges[i].a));
+		edge_steps[i] = IntSet(int(setup.edges[i].a) * width);
+		edge_row_steps[i] = IntSet(int(setup.edges[i].b));
+	}
+
+	const VecInt lane_index = IntLanes(1);
+	const VecInt negative_one = IntSet(-1);
+	const VecInt origin_x = IntSet(setup.attribute.origin_x);
+	const VecFloat depth_dx = FloatSet(setup.attribute.dx);
+	const VecFloat depth_scale = FloatSet(depth_buffer.GetFixedScale());
+	const VecFloat fixed_max = FloatSet(depth_buffer.GetFixedMax());
+	const VecInt color = IntSet(int(setup.packed_color));
+
+	ForEachDepthBlock(setup, depth_buffer, min_x, max_x, min_y, max_y, center_sample, [&](int x0, int x1, int y0, int y1)
+	{
+		const int first_x = x0 / width * width;
+		const VecInt first_column = IntSet(x0 - 1);	// Columns must be > x0 - 1
+		const VecInt past_last_column = IntSet(x1 + 1);	// and < x1 + 1
+
+		// Checked once for the block: the first and last rows bound the rows in between
+		const int last_x = x1 / width * width + width - 1;
+		if (depth_buffer.GetSpan<Stored>(y0, first_x, last_x) == nullptr
+			|| depth_buffer.GetSpan<Stored>(y1, first_x, last_x) == nullptr)
+		{
+			return;
+		}
+
+		VecInt w0, w1, w2, columns, covered, closer;
+		VecInt row_w0 = IntAdd(IntSet(int(setup.edges[0].At(first_x, y0))), edge_lanes[0]);
+		VecInt row_w1 = IntAdd(IntSet(int(setup.edges[1].At(first_x, y0))), edge_lanes[1]);
+		VecInt row_w2 = IntAdd(IntSet(int(setup.edges[2].At(first_x, y0))), edge_lanes[2]);
+		VecFloat row_start;
+		Vec z_values, depths;
+		uint32_t* row_pixels;
+		Stored* row_depths;
+		int offset;
+
+		for (int y = y0; y <= y1; ++y)
+		{
+			w0 = row_w0;
+			w1 = row_w1;
+			w2 = row_w2;
+			row_start = FloatSet(setup.attribute.RowStart(y));
+			row_pixels = frame_buffer.GetRow(y);
+			row_depths = depth_buffer.GetRow<Stored>(y);
+
+			for (int x = first_x; x <= x1; x += width)
+			{
+				// Inside the triangle (no negative edge function) and inside [x0, x1]
+				columns = IntAdd(IntSet(x), lane_index);
+				covered = IntGreater(IntOr(IntOr(w0, w1), w2), negative_one);
+				covered = MaskAnd(covered, MaskAnd(IntGreater(columns, first_column), IntGreater(past_last_column, columns)));
+
+				if (AnyLane(covered))
+				{
+					// A block never crosses a run of 8 pixels, so its pixels are contiguous in either layout
+					offset = frame_buffer.ColumnOffset(x);
+
+					// Same arithmetic as AttributePlane::AlongRow, so the result matches the scalar path exactly
+					z_values = Depth::Quantize(FloatAdd(row_start, FloatMul(depth_dx, ToFloat(IntSub(columns, origin_x)))),
+						depth_scale, fixed_max);
+					depths = Depth::Load(row_depths + offset);
+
+					// Higher 1/z value means lower z, closer to camera than existing pixel
+					closer = MaskAnd(covered, Depth::Greater(z_values, depths));
+					if (AnyLane(closer))
+					{
+						Depth::Store(row_depths + offset, Depth::Select(closer, z_values, depths));
+						StoreInts(row_pixels + offset, SelectInts(closer, color, LoadInts(row_pixels + offset)));
+					}
+				}
+
+				// Step one block to the right
+				w0 = IntAdd(w0, edge_steps[0]);
+				w1 = IntAdd(w1, edge_steps[1]);
+				w2 = IntAdd(w2, edge_steps[2]);
+			}
+
+			// Step one row down
+			row_w0 = IntAdd(row_w0, edge_row_steps[0]);
+			row_w1 = IntAdd(row_w1, edge_row_steps[1]);
+			row_w2 = IntAdd(row_w2, edge_row_steps[2]);
+		}
+	});
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Depth tested triangle kernel that processes one pixel at a time, one HiZ block at a time.
+ */
+template <typename Depth>
+static void DepthPixelKernel(const TriangleSetup& setup, FrameBuffer& frame_buffer, DepthBuffer& depth_buffer,
+	int min_x, int max_x, int min_y, int max_y)
+{
+	typedef typename Depth::Stored Stored;
+	float depth_scale = depth_buffer.GetFixedScale();
+	float fixed_max = depth_buffer.GetFixedMax();
+
+	ForEachDepthBlock(setup, depth_buffer, min_x, max_x, min_y, max_y, center_sample, [&](int x0, int x1, int y0, int y1)
+	{
+		TraverseTriangle(setup, frame_buffer, x0, x1, y0, y1,
+			[&](uint32_t* row_pixels, int x, int y, float row_start)
+			{
+				// Both buffers have the same layout, so pixel x has the same offset in both rows
+				int offset = frame_buffer.ColumnOffset(x);
+				Stored z_val = Depth::Quantize(setup.attribute.AlongRow(row_start, x), depth_scale, fixed_max);
+				Stored& depth = depth_buffer.GetRow<Stored>(y)[offset];
+				// Higher 1/z value means lower z, closer to camera than existing pixel
+				if (z_val > depth)
+				{
+					row_pixels[offset] = setup.packed_color;
+					depth = z_val;
+				}
+			});
+	});
+}
+
+/*
+ * Runs the SIMD depth kernel for the depth buffer's format, writing to target.
+ *
+ * @return false if the kernel could not be used and nothing was drawn
+ */
+bool GraphicsManager::RasterizeDepthBlocks(const TriangleSetup& setup, FrameBuffer& target, int min_x, int max_x, int min_y, int max_y)
+{
+	switch (this->depth_buffer.GetFormat())
+	{
+		case DepthFormat::UNORM16:
+			return DepthBlockKernel<Fixed16Depth>(setup, target, this->depth_buffer, min_x, max_x, min_y, max_y);
+		case DepthFormat::UNORM24:
+			return DepthBlockKernel<Fixed24Depth>(setup, target, this->depth_buffer, min_x, max_x, min_y, max_y);
+		default:
+			return DepthBlockKernel<FloatDepth>(setup, target, this->depth_buffer, min_x, max_x, min_y, max_y);
+	}
+}
+
+/*
+ * Runs the one pixel at a time depth kernel for the depth buffer's format, writing to target.
+ */
+void GraphicsManager::RasterizeDepthPixels(const TriangleSetup& setup, FrameBuffer& target, int min_x, int max_x, int min_y, int max_y)
+{
+	switch (this->depth_buffer.GetFormat())
+	{
+		case DepthFormat::UNORM16:
+			DepthPixelKernel<Fixed16Depth>(setup, target, this->depth_buffer, min_x, max_x, min_y, max_y);
+			break;
+		case DepthFormat::UNORM24:
+			DepthPixelKernel<Fixed24Depth>(setup, target, this->depth_buffer, min_x, max_x, min_y, max_y);
+			break;
+		default:
+			DepthPixelKernel<FloatDepth>(setup, target, this->depth_buffer, min_x, max_x, min_y, max_y);
+			break;
+	}
+}
+
+/*
+ * Depth tests the covered samples of one pixel and writes the color to the ones that pass.
+ * Samples are handled 4 at a time with SSE2 (sample counts are always 4 or 8).
+ *
+ * @param z_value - 1/z at the pixel center
+ * @param sample_depths - how far each sample's 1/z is from z_value
+ * @param covered - bit i is set if sample i is inside the triangle
+ * @return a mask of the samples that were written
+ */
+static inline unsigned int WriteSamples(float z_value, const float* sample_depths, unsigned int covered,
+	uint32_t color, float* depths, uint32_t* colors, int count)
+{
+	unsigned int passed = 0;
+#ifdef __SSE2__
+	const __m128i sample_bits = _mm_setr_epi32(1, 2, 4, 8);
+	const __m128 center = _mm_set1_ps(z_value);
+	const __m128i new_color = _mm_set1_epi32(int(color));
+	for (int s = 0; s < count; s += 4)
+	{
+		__m128 sample_z = _mm_add_ps(center, _mm_loadu_ps(sample_depths + s));
+		__m128 old_z = _mm_loadu_ps(depths + s);
+		__m128i in_triangle = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(int(covered >> s)), sample_bits), sample_bits);
+		__m128i pass = _mm_and_si128(_mm_castps_si128(_mm_cmpgt_ps(sample_z, old_z)), in_triangle);
+		unsigned int lanes = _mm_movemask_ps(_mm_castsi128_ps(pass));
+		if (lanes != 0)
+		{
+			__m128 pass_float = _mm_castsi128_ps(pass);
+			_mm_storeu_ps(depths + s, _mm_or_ps(_mm_and_ps(pass_float, sample_z), _mm_andnot_ps(pass_float, old_z)));
+			__m128i old_colors = _mm_loadu_si128((const __m128i*) (colors + s));
+			_mm_storeu_si128((__m128i*) (colors + s), _mm_or_si128(_mm_and_si128(pass, new_color), _mm_andnot_si128(pass, old_colors)));
+			passed |= lanes << s;
+		}
+	}
+#else
+	float sample_z;
+	for (int s = 0; s < count; ++s)
+	{
+		sample_z = z_value + sample_depths[s];
+		if ((covered >> s & 1) && sample_z > depths[s])
+		{
+			depths[s] = sample_z;
+			colors[s] = color;
+			passed |= 1u << s;
+		}
+	}
+#endif
+	return passed;
+}
+
+/*
+ * Multisampled depth tested triangle kernel. Every pixel gets a coverage mask from the edge
+ * functions at its sample points, is shaded once, and writes its color to the covered samples
+ * that are closer than what they already hold. With the FLOAT32 depth format, the depth
+ * buffer's HiZ level tracks the samples too, so hidden triangles and blocks are skipped.
+ */
+void GraphicsManager::RasterizeMultisampled(const TriangleSetup& setup, int min_x, int max_x, int min_y, int max_y)
+{
+	const int count = this->sample_buffer.GetSampleCount();
+	const int* pattern = this->sample_buffer.GetPattern();
+	const unsigned int all_samples = (1u << count) - 1;
+
+	// Offsets of each sample from the pixel center. Edge a and b are per pixel (SUBPIXEL_SCALE
+	// sub-pixel steps), and the pattern is in sub-pixel steps, so the edge offsets are exact.
+	int64_t sample_edges[3][SampleBuffer::max_samples];
+	int64_t reach[3];	// How far below its center value any sample can take an edge function
+	float sample_depths[SampleBuffer::max_samples];
+	SampleSpread spread = {{0, 0, 0}, 0.0f, this->depth_buffer.GetFormat() == DepthFormat::FLOAT32};
+	for (int i = 0; i < 3; ++i)
+	{
+		reach[i] = 0;
+		for (int s = 0; s < count; ++s)
+		{
+			sample_edges[i][s] = setup.edges[i].a / SUBPIXEL_SCALE * pattern[2 * s]
+				+ setup.edges[i].b / SUBPIXEL_SCALE * pattern[2 * s + 1];
+			reach[i] = std::max(reach[i], -sample_edges[i][s]);
+			spread.edges[i] = std::max(spread.edges[i], std::abs(sample_edges[i][s]));
+		}
+	}
+	for (int s = 0; s < count; ++s)
+	{
+		sample_depths[s] = (setup.attribute.dx * pattern[2 * s] + setup.attribute.dy * pattern[2 * s + 1]) / SUBPIXEL_SCALE;
+		spread.depth = std::max(spread.depth, std::abs(sample_depths[s]));
+	}
+
+	// Skip the whole triangle if it is behind every sample already drawn in this part of the screen
+	float nearest, farthest;
+	if (spread.use_hiz)
+	{
+		DepthExtremes(setup.attribute, min_x, max_x, min_y, max_y, nearest, farthest);
+		if (nearest + spread.depth <= this->depth_buffer.GetFarthest(min_x, max_x, min_y, max_y))
+		{
+			return;
+		}
+		this->depth_buffer.PrepareRect(min_x, max_x, min_y, max_y);
+	}
+
+	ForEachDepthBlock(setup, this->depth_buffer, min_x, max_x, min_y, max_y, spread, [&](int x0, int x1, int y0, int y1)
+	{
+		int64_t w0, w1, w2;
+		float row_start, z_value;
+		unsigned int covered, passed;
+		uint8_t* states;
+		uint32_t* colors;
+		float* depths;
+		uint32_t* row_pixels;
+
+		for (int y = y0; y <= y1; ++y)
+		{
+			w0 = setup.edges[0].At(x0, y);
+			w1 = setup.edges[1].At(x0, y);
+			w2 = setup.edges[2].At(x0, y);
+			row_start = setup.attribute.RowStart(y);
+			row_pixels = this->frame_buffer.GetRow(y);
+			states = &this->sample_buffer.GetState(y, x0);
+			colors = this->sample_buffer.GetColors(y, x0);
+			depths = this->sample_buffer.GetDepths(y, x0);
+
+			for (int x = x0; x <= x1; ++x, ++states, colors += count, depths += count,
+				w0 += setup.edges[0].a, w1 += setup.edges[1].a, w2 += setup.edges[2].a)
+			{
+				// Coverage mask: every sample is inside when the center is far enough inside every edge
+				if (w0 >= reach[0] && w1 >= reach[1] && w2 >= reach[2])
+				{
+					covered = all_samples;
+				}
+				else
+				{
+					covered = 0;
+					for (int s = 0; s < count; ++s)
+					{
+						if (((w0 + sample_edges[0][s]) | (w1 + sample_edges[1][s]) | (w2 + sample_edges[2][s])) >= 0)
+						{
+							covered |= 1u << s;
+						}
+					}
+					if (covered == 0)
+					{
+						continue;
+					}
+				}
+
+				// The first triangle in a frame to touch the pixel starts its samples from the pixel's color
+				if (*states == SampleBuffer::UNTOUCHED)
+				{
+					std::fill(colors, colors + count, row_pixels[this->frame_buffer.ColumnOffset(x)]);
+					std::fill(depths, depths + count, 0.0f);
+					*states = SampleBuffer::UNIFORM;
+				}
+
+				// Shade once, then depth test each covered sample (higher 1/z is closer)
+				z_value = setup.attribute.AlongRow(row_start, x);
+				passed = WriteSamples(z_value, sample_depths, covered, setup.packed_color, depths, colors, count);
+
+				if (passed == all_samples)
+				{
+					*states = SampleBuffer::UNIFORM;
+				}
+				else if (passed != 0)
+				{
+					*states = SampleBuffer::MIXED;
+				}
+			}
+		}
+	});
+}
+
+/*
+ * Fills in the pixels of a triangle that are inside a rectangle of the screen.
+ *
+ * @param setup - the triangle, from SetupTriangle (and SetupAttributePlane for GRADIENT and DEPTH)
+ * @param rect - the part of the screen to draw in
+ */
+void GraphicsManager::RasterizeTriangle(const TriangleSetup& setup, ScreenRect rect)
+{
+	int min_x = std::max(setup.bounds.min_x, rect.min_x);
+	int max_x = std::min(setup.bounds.max_x, rect.max_x);
+	int min_y = std::max(setup.bounds.min_y, rect.min_y);
+	int max_y = std::min(setup.bounds.max_y, rect.max_y);
+	if (min_x > max_x || min_y > max_y)
+	{
+		return;
+	}
+
+	switch (setup.mode)
+	{
+		case RasterMode::FLAT:
+			TraverseTriangle(setup, this->frame_buffer, min_x, max_x, min_y, max_y,
+				[this, &setup](uint32_t* row_pixels, int x, int y, float row_start)
+				{
+					row_pixels[this->frame_buffer.ColumnOffset(x)] = setup.packed_color;
+				});
+			break;
+
+		case RasterMode::GRADIENT:
+			TraverseTriangle(setup, this->frame_buffer, min_x, max_x, min_y, max_y,
+				[this, &setup](uint32_t* row_pixels, int x, int y, float row_start)
+				{
+					float intensity = setup.attribute.AlongRow(row_start, x);
+					row_pixels[this->frame_buffer.ColumnOffset(x)] = FrameBuffer::PackColor(setup.color * intensity);
+				});
+			break;
+
+		case RasterMode::DEPTH:
+		case RasterMode::VISIBILITY:
+		{
+			if (setup.mode == RasterMode::DEPTH && this->sample_buffer.IsActive())
+			{
+				// Depth lives in the sample buffer instead of the depth buffer
+				this->RasterizeMultisampled(setup, min_x, max_x, min_y, max_y);
+				break;
+			}
+
+			// Skip the whole triangle if it is behind everything already drawn in this part of the screen
+			float nearest, farthest;
+			DepthExtremes(setup.attribute, min_x, max_x, min_y, max_y, nearest, farthest);
+			if (this->depth_buffer.ToStored(nearest) <= this->depth_buffer.GetFarthest(min_x, max_x, min_y, max_y))
+			{
+				break;
+			}
+
+			// Finish clearing the depth tiles under the triangle before testing against them
+			this->depth_buffer.PrepareRect(min_x, max_x, min_y, max_y);
+			// Colors go to the frame buffer, triangle IDs to the visibility buffer
+			FrameBuffer& target = (setup.mode == RasterMode::VISIBILITY) ? this->visibility_buffer : this->frame_buffer;
+			if (this->use_simd_kernels && this->RasterizeDepthBlocks(setup, target, min_x, max_x, min_y, max_y))
+			{
+				break;
+			}
+
+			// Scalar fallback, one pixel at a time
+			this->RasterizeDepthPixels(setup, target, min_x, max_x, min_y, max_y);
+			break;
+		}
+	}
+}
@@ -7,6 +7,8 @@
  */
 
 #include "../lib/graphics.h"
+#include <algorithm>
+#include <cmath>
 #include <unistd.h>	// For calling sleep() during debugging
 #include <iostream>	// For print statements for debugging
 
@@ -50,6 +52,9 @@ void Scene::RenderScene()
 {
 	// Reset depth buffer
 	this->graphics_manager->ClearDepthBuffer();
+
+	// Triangles are sorted into screen tiles and drawn in parallel at the end (if there are multiple render threads)
+	this->graphics_manager->BeginTriangleBatch();
 	
 	// Get planes for clipping
 	std::array<Plane * , 5> planes;
@@ -61,73 +66,178 @@ void Scene::RenderScene()
 	// Get camera transform (this will not change during the render)
 	TransformMatrix world_to_cameraspace = this->main_camera->GetWorldToCameraMatrix();
 
-	// Render one model instance at a time
+	// Every model instance has a render instance whose lists are reused from frame to frame, so once
+	// they have grown to fit, a frame does not allocate. Only grow the pool before the queue points into it.
+	if (this->render_instances.size() < this->model_instances.size())
+	{
+		this->render_instances.resize(this->model_instances.size());
+	}
+
+	// Move every instance into camera space and clip it, keeping the ones that can be seen
+	this->draw_queue.clear();
 	RenderableModelInstance * clipped_instance;
-	for (ModelInstance * instance : this->model_instances)
+	HomCoordinates center;
+	TransformMatrix model_to_camera;
+	int num_instances = this->model_instances.size();
+	for (int i = 0; i < num_instances; ++i)
 	{
-		// Create a copy of the instance for clipping
-		clipped_instance = new RenderableModelInstance(instance);
-		// Put instance in camera space. We will generate the bounding sphere before checking with each plane,
-		// 		since clipping against a plane may change the points in the model, changing the bounding sphere.
-		clipped_instance->GenerateWorldspacePoints();
-		clipped_instance->ApplyTransform(world_to_cameraspace);
+		// Model space -> world space -> camera space, composed into a single model-view matrix
+		// that both the view test and the point transform use
+		model_to_camera = world_to_cameraspace * this->model_instances[i]->GetTransform()->GetMatrix();
+
+		// Skip instances whose bounding sphere is entirely outside the view, before copying
+		// their triangles or transforming any of their points
+		if (!Scene::IsInstanceInView(*(this->model_instances[i]), model_to_camera, planes))
+		{
+			continue;
+		}
+
+		// Reset the instance's copy for clipping
+		clipped_instance = &(this->render_instances[i]);
+		clipped_instance->Reset(this->model_instances[i]);
+		// Put instance in camera space (one transform per point, with the model and camera matrices combined).
+		// This also moves the model's bounding sphere into camera space. Clipping only ever cuts the
+		// 		triangles, so the clipped points stay inside that sphere for every plane.
+		clipped_instance->GenerateCameraspacePoints(model_to_camera);
 		
 		// Clip the instance
 		Scene::ClipInstance(*clipped_instance, planes);
 
-		// Render the instance if it is not clipped
-		if (!clipped_instance->GetIsRejected())
+		if (clipped_instance->GetIsRejected())
 		{
-			RenderInstance(clipped_instance);
+			continue;
 		}
+
+		// The model's sphere still contains the clipped points, so it is good enough to sort by
+		center = clipped_instance->GetBoundingSphereCenter();
+		this->draw_queue.push_back(QueuedInstance{clipped_instance,
+			std::sqrt(center[0] * center[0] + center[1] * center[1] + center[2] * center[2]) - clipped_instance->GetBoundingSphereRadius(),
+			i, this->model_instances[i]->GetDepthSorted()});
 	}
-}
 
-void Scene::ClipInstance(RenderableModelInstance & instance, std::array<Plane*, 5> planes)
-{
-	// Clip against all of the planes, stopping if the instance is rejected by any plane
-	for (int i = 0; i < planes.size() && !instance.GetIsRejected(); ++i)
+	// Draw the nearest instances first, so the depth test can reject the pixels they hide before shading them.
+	// Instances that opted out are drawn last, in the order they were added.
+	std::sort(this->draw_queue.begin(), this->draw_queue.end(), [](const QueuedInstance& a, const QueuedInstance& b)
 	{
-		Scene::ClipInstanceAgainstPlane(instance, planes[i]);
+		if (a.depth_sorted != b.depth_sorted)
+		{
+			return a.depth_sorted;
+		}
+		if (a.depth_sorted && a.distance != b.distance)
+		{
+			return a.distance < b.distance;
+		}
+		return a.order < b.order;
+	});
+
+	// With deferred shading, the triangles only leave their IDs in the visibility buffer (0 means no triangle)
+	bool deferred = this->graphics_manager->GetShadingMode() == ShadingMode::DEFERRED;
+	if (deferred)
+	{
+		this->graphics_manager->ClearVisibilityBuffer();
 	}
 
+	// Render one model instance at a time
+	uint32_t next_id = 1;
+	for (QueuedInstance& queued : this->draw_queue)
+	{
+		queued.first_id = next_id;
+		RenderInstance(queued.instance, next_id);
+		next_id += queued.instance->GetTriangles()->size();
+	}
+
+	this->graphics_manager->EndTriangleBatch();
+
+	// Shade each visible pixel once, while the clipped triangles are still around to look up
+	if (deferred)
+	{
+		this->ShadeVisibleTriangles();
+	}
+	this->draw_queue.clear();
 }
 
-void Scene::ClipInstanceAgainstPlane(RenderableModelInstance & instance, Plane* plane)
+void Scene::ShadeVisibleTriangles()
 {
-	// Check the bounding sphere to see if all, somme, or none of the points are in bounds
-	Triangle last = instance.triangles[instance.triangles.size() - 1];
-	instance.GenerateBoundingSphere();
-	float distance = plane->SignedDistance(instance.GetBoundingSphereCenter());	// Sphere center's distance from the plane
+	this->graphics_manager->ResolveVisibilityBuffer([this](uint32_t id)
+	{
+		// Find the last instance whose first ID is not past this one (the queue is in ID order)
+		std::vector<QueuedInstance>::const_iterator queued = std::upper_bound(this->draw_queue.begin(), this->draw_queue.end(), id,
+			[](uint32_t value, const QueuedInstance& entry) { return value < entry.first_id; }) - 1;
+		const Triangle& triangle = (*queued->instance->GetTriangles())[id - queued->first_id];
+		return FrameBuffer::PackColor(triangle.color);
+	});
+}
+
+void Scene::ClipInstance(RenderableModelInstance & instance, std::array<Plane*, 5> planes)
+{
+	// Check the bounding sphere against every plane to see if all, some, or none of the points are in bounds
+	std::array<Plane*, 5> crossed_planes;	// The planes that the sphere intersects
+	int crossed_count = 0;
+	float distance;
 	float sphere_radius = instance.GetBoundingSphereRadius();
-	if (distance > sphere_radius)	// Distance > radius, so every point is definitely on the correct side of the plane
+	for (Plane* plane : planes)
+	{
+		distance = plane->SignedDistance(instance.GetBoundingSphereCenter());	// Sphere center's distance from the plane
+		if (distance < -sphere_radius)	// Distance < -radius, so every point is definitely on the wrong side of the plane
+		{
+			// This object is entirely out of bounds...
+			instance.Reject();
+			return;
+		}
+		if (distance <= sphere_radius)	// The sphere intersects the plane, and some points may be on different sides
+		{
+			crossed_planes[crossed_count++] = plane;
+		}
+		// Otherwise distance > radius, so every point is on the correct side of the plane
+	}
+
+	if (crossed_count == 0)
 	{
 		// This object is in the bounds entirely!! The instance will keep its current triangles.
-	} else if (distance < -sphere_radius)	// Distance < -radius, so every point is definitely on the wrong side of the plane
+		return;
+	}
+
+	// This object is partially in bounds. Clip the triangles against every plane the sphere crosses, in one pass
+	instance.ClipTrianglesAgainstPlanes(crossed_planes.data(), crossed_count);
+
+	// The sphere is bigger than the model, so it can cross a plane when every triangle is outside
+	if (instance.triangles.empty())
 	{
-		// This object is entirely out of bounds...
 		instance.Reject();
-	} else {	// Distance is in between the radius, so the sphere intersects the plane, and some points may be on different sides
-		// This object is partially in bounds. WE MUST CLIP THE TRIANGLES NOW!!!
-		instance.ClipTrianglesAgainstPlane(plane);
 	}
 }
 
-void Scene::RenderInstance(RenderableModelInstance * to_render)
+bool Scene::IsInstanceInView(ModelInstance & instance, const TransformMatrix& model_to_camera, std::array<Plane*, 5> planes)
+{
+	// Place the model's sphere exactly as RenderableModelInstance::GenerateCameraspacePoints() will
+	// (RenderScene passes both the same matrix), so an instance kept here is never rejected by the
+	// sphere test in ClipInstance()
+	HomCoordinates center = model_to_camera * instance.GetModel()->GetBoundingSphereCenter();
+	float radius = instance.GetScaledBoundingSphereRadius();
+	for (Plane* plane : planes)
+	{
+		if (plane->SignedDistance(center) < -radius)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void Scene::RenderInstance(RenderableModelInstance * to_render, uint32_t first_id)
 {
 
 	// The points in the model instance should at this point be in camera space,
 	// having the local transform and the camera transform applied, along with any clipping.
 
 	// Project all points from the model instance
-	std::vector<HomCoordinates>* points = to_render->GetPoints();
-	Point2D projected_points[ points->size() ];	// 1 to 1 mapping between 3D points in camera space and 2D points on screen
+	VertexStream* points = to_render->GetPoints();
+	ScratchArena& scratch = this->graphics_manager->GetScratchArena();
+	ScratchArena::Marker mark = scratch.Mark();
+	SubPixelPoint* projected_points = scratch.Allocate<SubPixelPoint>(points->Size());	// 1 to 1 mapping between 3D points in camera space and 2D points on screen
 
-	for (int i = 0; i < points->size(); ++i)
-	{
-		// Apply camera space -> screen space projection
-		projected_points[i] = this->main_camera->ProjectVertex((*points)[i]);
-	}
+	// Apply camera space -> screen space projection (keeping sub-pixel precision)
+	this->main_camera->ProjectVertexStream(*points, projected_points);
 
 	// Cull the back-facing triangles
 	to_render->CullBackFaces();
@@ -136,16 +246,27 @@ void Scene::RenderInstance(RenderableModelInstance * to_render)
 	std::vector<Triangle>* triangles = to_render->GetTriangles();
 	for (int i = 0; i < triangles->size(); ++i)
 	{
-		this->RenderTriangle((*triangles)[i], projected_points, points);
+		this->RenderTriangle((*triangles)[i], projected_points, *points, first_id + i);
 	} 
+	scratch.Rewind(mark);
 }
 
-void Scene::RenderTriangle(Triangle triangle, Point2D projected_vertices[], std::vector<HomCoordinates>* cameraspace_points)
+void Scene::RenderTriangle(Triangle triangle, SubPixelPoint projected_vertices[], const VertexStream& cameraspace_points, uint32_t id)
 {
 	// Attributes for depth buffer = 1 / Z
-	float attribute0 = 1.0 / (cameraspace_points->at(triangle.p0))[2];
-	float attribute1 = 1.0 / (cameraspace_points->at(triangle.p1))[2];
-	float attribute2 = 1.0 / (cameraspace_points->at(triangle.p2))[2];
+	float attribute0 = 1.0 / cameraspace_points.Z()[triangle.p0];
+	float attribute1 = 1.0 / cameraspace_points.Z()[triangle.p1];
+	float attribute2 = 1.0 / cameraspace_points.Z()[triangle.p2];
+
+	if (this->graphics_manager->GetShadingMode() == ShadingMode::DEFERRED)
+	{
+		// Only record which triangle is closest; it is shaded after every triangle is drawn
+		this->graphics_manager->DrawVisibilityTriangle(
+			projected_vertices[triangle.p0], projected_vertices[triangle.p1], projected_vertices[triangle.p2],
+			id, attribute0, attribute1, attribute2
+		);
+		return;
+	}
 
 	// Draw triangle, only overwriting pixels that are closer to the camera than what already exists
 	this->graphics_manager->DrawDepthTriangle(
@@ -0,0 +1,217 @@
+/* graphics_tiles.cpp
+ *
+ * Definitions for the thread pool and tile binner outlined in graphics_tiles.h,
+ * and the GraphicsManager functions for drawing batches of triangles in parallel.
+ *
+ * @author Alex Wills
+ * @date May 16, 2023
+ */
+
+#include "../lib/graphics.h"
+#include <algorithm>
+
+// Each thread clears the depth tiles under its own screen tile, so they must not straddle two screen tiles
+static_assert(TileBinner::tile_size % DepthBuffer::tile_size == 0, "Depth tiles must fit evenly inside screen tiles");
+
+
+/*************************************************************/
+/*                      RenderThreadPool                     */
+/*************************************************************/
+
+void RenderThreadPool::SetThreadCount(int thread_count)
+{
+	if (thread_count < 1)
+	{
+		thread_count = 1;
+	}
+	if (thread_count == this->GetThreadCount())
+	{
+		return;
+	}
+
+	// Stop the existing workers
+	{
+		std::lock_guard<std::mutex> lock(this->pool_mutex);
+		this->stopping = true;
+	}
+	this->work_ready.notify_all();
+	for (std::thread& worker : this->workers)
+	{
+		worker.join();
+	}
+	this->workers.clear();
+
+	// Start the new workers (the caller of Run() is thread 0)
+	this->stopping = false;
+	for (int i = 1; i < thread_count; ++i)
+	{
+		this->workers.push_back(std::thread(&RenderThreadPool::WorkerLoop, this, i, this->job_number));
+	}
+}
+
+void RenderThreadPool::Run(int num_tasks, const std::function<void(int, int)>& job)
+{
+	if (this->workers.empty())
+	{
+		// Nobody to share with
+		for (int task = 0; task < num_tasks; ++task)
+		{
+			job(task, 0);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(this->pool_mutex);
+		this->job = job;
+		this->num_tasks = num_tasks;
+		this->next_task = 0;
+		this->busy_workers = this->workers.size();
+		this->job_number++;
+	}
+	this->work_ready.notify_all();
+
+	// Help out, then wait for the workers to finish their last tasks
+	this->WorkOnTasks(0);
+
+	std::unique_lock<std::mutex> lock(this->pool_mutex);
+	this->work_done.wait(lock, [this] { return this->busy_workers == 0; });
+}
+
+void RenderThreadPool::WorkOnTasks(int thread_index)
+{
+	int task = this->next_task++;
+	while (task < this->num_tasks)
+	{
+		this->job(task, thread_index);
+		task = this->next_task++;
+	}
+}
+
+void RenderThreadPool::WorkerLoop(int thread_index, unsigned int last_job)
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(this->pool_mutex);
+			this->work_ready.wait(lock, [this, last_job] { return this->stopping || this->job_number != last_job; });
+			if (this->stopping)
+			{
+				return;
+			}
+			last_job = this->job_number;
+		}
+
+		this->WorkOnTasks(thread_index);
+
+		{
+			std::lock_guard<std::mutex> lock(this->pool_mutex);
+			this->busy_workers--;
+		}
+		this->work_done.notify_one();
+	}
+}
+
+
+/*************************************************************/
+/*                         TileBinner                        */
+/*************************************************************/
+
+void TileBinner::Resize(int canvas_width, int canvas_height)
+{
+	this->canvas_width = canvas_width;
+	this->canvas_height = canvas_height;
+	this->tiles_x = (canvas_width + TileBinner::tile_size - 1) / TileBinner::tile_size;
+	this->tiles_y = (canvas_height + TileBinner::tile_size - 1) / TileBinner::tile_size;
+	this->bins.resize(this->tiles_x * this->tiles_y);
+	this->Clear();
+}
+
+void TileBinner::Clear()
+{
+	this->triangles.clear();
+	for (std::vector<int>& bin : this->bins)
+	{
+		bin.clear();
+	}
+}
+
+void TileBinner::AddTriangle(const TriangleSetup& setup)
+{
+	int index = this->triangles.size();
+	this->triangles.push_back(setup);
+
+	// The bounds are already clipped to the screen
+	int first_tile_x = setup.bounds.min_x / TileBinner::tile_size;
+	int last_tile_x = setup.bounds.max_x / TileBinner::tile_size;
+	int first_tile_y = setup.bounds.min_y / TileBinner::tile_size;
+	int last_tile_y = setup.bounds.max_y / TileBinner::tile_size;
+
+	for (int tile_y = first_tile_y; tile_y <= last_tile_y; ++tile_y)
+	{
+		for (int tile_x = first_tile_x; tile_x <= last_tile_x; ++tile_x)
+		{
+			this->bins[tile_y * this->tiles_x + tile_x].push_back(index);
+		}
+	}
+}
+
+ScreenRect TileBinner::GetTileRect(int tile) const
+{
+	int tile_x = tile % this->tiles_x;
+	int tile_y = tile / this->tiles_x;
+
+	ScreenRect rect;
+	rect.min_x = tile_x * TileBinner::tile_size;
+	rect.min_y = tile_y * TileBinner::tile_size;
+	rect.max_x = std::min(rect.min_x + TileBinner::tile_size, this->canvas_width) - 1;
+	rect.max_y = std::min(rect.min_y + TileBinner::tile_size, this->canvas_height) - 1;
+	return rect;
+}
+
+
+/*************************************************************/
+/*            Drawing batches of triangles in tiles          */
+/*************************************************************/
+
+void GraphicsManager::SetRenderThreads(int thread_count)
+{
+	this->render_threads.SetThreadCount(thread_count);
+	std::cout << "~ Rasterizing with " << this->render_threads.GetThreadCount() << " thread(s)" << std::endl;
+}
+
+void GraphicsManager::BeginTriangleBatch()
+{
+	// With a single thread, drawing right away is the same as binning and drawing later
+	if (this->render_threads.GetThreadCount() > 1)
+	{
+		this->tile_binner.Clear();
+		this->is_batching = true;
+	}
+}
+
+void GraphicsManager::EndTriangleBatch()
+{
+	if (!this->is_batching)
+	{
+		return;
+	}
+	this->is_batching = false;
+
+	if (this->tile_binner.IsEmpty())
+	{
+		return;
+	}
+
+	// Every tile draws its own triangles, in the order they were submitted
+	this->render_threads.Run(this->tile_binner.GetTileCount(), [this](int tile, int)
+	{
+		ScreenRect rect = this->tile_binner.GetTileRect(tile);
+		for (int index : this->tile_binner.GetBin(tile))
+		{
+			this->RasterizeTriangle(this->tile_binner.GetTriangle(index), rect);
+		}
+	});
+
+	this->tile_binner.Clear();
+}
@@ -8,8 +8,30 @@
 #include "../lib/graphics.h"
 
 
-//TODO: Store rotation MATRIX, not just euler angles
 Transform::operator TransformMatrix() const
+{
+	return this->GetMatrix();
+}
+
+const TransformMatrix& Transform::GetMatrix() const
+{
+	// Most transforms do not change from frame to frame, so compare the values with the ones
+	// the cached matrix was built from before paying for the sines, cosines, and products
+	const float values[9] = {
+		this->scale[0], this->scale[1], this->scale[2],
+		this->rotation[0], this->rotation[1], this->rotation[2],
+		this->translation[0], this->translation[1], this->translation[2]
+	};
+	if (!this->matrix_ready || !std::equal(values, values + 9, this->matrix_values))
+	{
+		this->matrix = this->BuildMatrix();
+		std::copy(values, values + 9, this->matrix_values);
+		this->matrix_ready = true;
+	}
+	return this->matrix;
+}
+
+TransformMatrix Transform::BuildMatrix() const
 {
 
 	// First initialize matrices
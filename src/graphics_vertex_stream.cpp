@@ -0,0 +1,108 @@
+/* graphics_vertex_stream.cpp
+ *
+ * The batch transform kernel for the VertexStream outlined in graphics_vertex_stream.h.
+ *
+ * Every point is multiplied by the same matrix, so the 12 matrix values are broadcast into
+ * registers once, and then each step loads 4 (SSE2) or 8 (AVX2) x, y, and z values, and
+ * stores the transformed x, y, and z. The streams are aligned and padded to whole registers,
+ * so there is no scalar tail. Without SSE2 (other CPUs), a plain loop does the same math.
+ *
+ * The kernels add the products in the same order as TransformMatrix * HomCoordinates and do
+ * not use fused multiply-adds. The makefile builds with -ffp-contract=off so the compiler does
+ * not fuse the scalar math either (it would with FMA enabled, e.g. -march=native), and every
+ * path gives exactly the same points.
+ *
+ * @author Alex Wills
+ * @date May 25, 2023
+ */
+
+#include "../lib/graphics.h"
+
+// Pick the widest vector instructions the compiler was allowed to use.
+// SSE2 is part of every x86-64 CPU, AVX2 needs -mavx2 (or -march=native).
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The streams pad their arrays for the widest kernel
+static_assert(VertexStream::lane_count % 8 == 0, "Vertex streams must pad to whole AVX registers");
+
+void VertexStream::TransformFrom(const VertexStream& source, const TransformMatrix& matrix)
+{
+	// Pull the matrix out of its bounds checked accessor once, instead of 12 times per point
+	float m[3][4];
+	for (int row = 0; row < 3; ++row)
+	{
+		for (int column = 0; column < 4; ++column)
+		{
+			m[row][column] = matrix(row, column);
+		}
+	}
+
+	this->Resize(source.count);
+	const float* source_x = source.x;
+	const float* source_y = source.y;
+	const float* source_z = source.z;
+	float* x = this->x;
+	float* y = this->y;
+	float* z = this->z;
+	int padded_size = source.PaddedSize();
+
+	// Each step loads all of its inputs before storing, so the source may be this stream
+#if defined(__AVX2__)
+	__m256 row0[4], row1[4], row2[4];
+	for (int column = 0; column < 4; ++column)
+	{
+		row0[column] = _mm256_set1_ps(m[0][column]);
+		row1[column] = _mm256_set1_ps(m[1][column]);
+		row2[column] = _mm256_set1_ps(m[2][column]);
+	}
+	__m256 in_x, in_y, in_z;
+	for (int i = 0; i < padded_size; i += 8)
+	{
+		in_x = _mm256_load_ps(source_x + i);
+		in_y = _mm256_load_ps(source_y + i);
+		in_z = _mm256_load_ps(source_z + i);
+		_mm256_store_ps(x + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(row0[0], in_x),
+			_mm256_mul_ps(row0[1], in_y)), _mm256_mul_ps(row0[2], in_z)), row0[3]));
+		_mm256_store_ps(y + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(row1[0], in_x),
+			_mm256_mul_ps(row1[1], in_y)), _mm256_mul_ps(row1[2], in_z)), row1[3]));
+		_mm256_store_ps(z + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(row2[0], in_x),
+			_mm256_mul_ps(row2[1], in_y)), _mm256_mul_ps(row2[2], in_z)), row2[3]));
+	}
+#elif defined(__SSE2__)
+	__m128 row0[4], row1[4], row2[4];
+	for (int column = 0; column < 4; ++column)
+	{
+		row0[column] = _mm_set1_ps(m[0][column]);
+		row1[column] = _mm_set1_ps(m[1][column]);
+		row2[column] = _mm_set1_ps(m[2][column]);
+	}
+	__m128 in_x, in_y, in_z;
+	for (int i = 0; i < padded_size; i += 4)
+	{
+		in_x = _mm_load_ps(source_x + i);
+		in_y = _mm_load_ps(source_y + i);
+		in_z = _mm_load_ps(source_z + i);
+		_mm_store_ps(x + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(row0[0], in_x),
+			_mm_mul_ps(row0[1], in_y)), _mm_mul_ps(row0[2], in_z)), row0[3]));
+		_mm_store_ps(y + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(row1[0], in_x),
+			_mm_mul_ps(row1[1], in_y)), _mm_mul_ps(row1[2], in_z)), row1[3]));
+		_mm_store_ps(z + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(row2[0], in_x),
+			_mm_mul_ps(row2[1], in_y)), _mm_mul_ps(row2[2], in_z)), row2[3]));
+	}
+#else
+	float in_x, in_y, in_z;
+	for (int i = 0; i < padded_size; ++i)
+	{
+		in_x = source_x[i];
+		in_y = source_y[i];
+		in_z = source_z[i];
+		x[i] = m[0][0] * in_x + m[0][1] * in_y + m[0][2] * in_z + m[0][3];
+		y[i] = m[1][0] * in_x + m[1][1] * in_y + m[1][2] * in_z + m[1][3];
+		z[i] = m[2][0] * in_x + m[2][1] * in_y + m[2][2] * in_z + m[2][3];
+	}
+#endif
+}
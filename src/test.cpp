@@ -153,6 +153,7 @@ int main()
 	GraphicsManager* manager = &test;
 	test.OpenWindow(700, 700);
 	test.GetMainCamera()->SetViewportDistance(0.2);
+	test.SetRenderThreads(std::thread::hardware_concurrency());
 
 	// triforce(&test);
 
@@ -0,0 +1,82 @@
+/* multisample_test.cpp
+ *
+ * Checks multisample anti-aliasing offscreen: pixels that a triangle's edge cuts in half
+ * must resolve to the average of the triangle's color and the background, with 4x and 8x
+ * samples.
+ *
+ * Build and run with `make check`. Prints every failure and exits with 1 if there were any.
+ *
+ * @author Alex Wills
+ * @date May 26, 2023
+ */
+
+#include "../lib/graphics.h"
+#include <cstdio>
+#include <cstdint>
+
+static int failures = 0;
+
+/*
+ * Prints a failed check and counts it.
+ */
+static void Fail(const char* test, const char* message, int x, int y)
+{
+	std::printf("FAIL %s: %s at pixel (%d, %d)\n", test, message, x, y);
+	++failures;
+}
+
+/*
+ * Compares one resolved pixel with the color it should have.
+ *
+ * @param screen_x, screen_y - the pixel, with 0, 0 at the center of the screen (y is up)
+ */
+static void CheckPixel(GraphicsManager& graphics, const char* test, const char* message, int screen_x, int screen_y, Color expected)
+{
+	const FrameBuffer* frame_buffer = graphics.GetFrameBuffer();
+	uint32_t pixel = frame_buffer->GetLinearRow(frame_buffer->GetHeight() / 2 - screen_y)[frame_buffer->GetWidth() / 2 + screen_x];
+	if (pixel != FrameBuffer::PackColor(expected))
+	{
+		Fail(test, message, screen_x, screen_y);
+	}
+}
+
+/*
+ * Draws a white triangle on black with a vertical left edge and a horizontal bottom edge, both
+ * through pixel centers. The 4x and 8x patterns put exactly half of their samples on each side
+ * of those lines, so the pixels on the edges must resolve to half white.
+ */
+static void CheckEdgeResolve(int samples, const char* test)
+{
+	const Color white = {255, 255, 255};
+	const Color half_white = {128, 128, 128};	// 255 / 2, rounded to the nearest value
+
+	GraphicsManager graphics;
+	graphics.SetMultisampling(samples);
+	graphics.OpenOffscreen(64, 64);
+	graphics.ChangeBrushColor(BLACK);
+	graphics.ClearScreen();
+	graphics.ClearDepthBuffer();
+	graphics.DrawDepthTriangle(SubPixelPoint{0, 20 * SUBPIXEL_SCALE}, SubPixelPoint{0, -20 * SUBPIXEL_SCALE},
+		SubPixelPoint{30 * SUBPIXEL_SCALE, -20 * SUBPIXEL_SCALE}, white, 0.5f, 0.5f, 0.5f);
+	graphics.RefreshScreen();
+
+	CheckPixel(graphics, test, "the left edge is not half white", 0, 0, half_white);
+	CheckPixel(graphics, test, "the bottom edge is not half white", 8, -20, half_white);
+	CheckPixel(graphics, test, "the inside is not white", 8, 0, white);
+	CheckPixel(graphics, test, "the outside is not black", -1, 0, BLACK);
+	graphics.CloseWindow();
+}
+
+int main()
+{
+	CheckEdgeResolve(4, "edge resolve (4x)");
+	CheckEdgeResolve(8, "edge resolve (8x)");
+
+	if (failures > 0)
+	{
+		std::printf("multisample_test: %d checks failed\n", failures);
+		return 1;
+	}
+	std::printf("multisample_test: all checks passed\n");
+	return 0;
+}
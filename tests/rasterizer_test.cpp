@@ -0,0 +1,213 @@
+/* rasterizer_test.cpp
+ *
+ * Checks the depth tested triangle rasterizer offscreen:
+ * - Triangles that share an edge never draw a pixel twice and never leave a gap (the top-left
+ *   fill rule), for every edge of a fan of triangles around a point.
+ * - The SIMD block kernels draw exactly the same image as the one pixel at a time kernel, for
+ *   every depth format.
+ *
+ * Build and run with `make check`. Prints every failure and exits with 1 if there were any.
+ *
+ * @author Alex Wills
+ * @date May 26, 2023
+ */
+
+#include "../lib/graphics.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+static const int canvas_size = 256;
+static int failures = 0;
+
+/*
+ * Prints a failed check and counts it.
+ */
+static void Fail(const char* test, const char* message, int x, int y)
+{
+	std::printf("FAIL %s: %s at pixel (%d, %d)\n", test, message, x, y);
+	++failures;
+}
+
+/*
+ * Returns which side of the line from a to b the point (x, y) is on: positive for the left
+ * (counter-clockwise) side, 0 if it is on the line. All values are in sub-pixel steps.
+ */
+static int64_t Side(SubPixelPoint a, SubPixelPoint b, int64_t x, int64_t y)
+{
+	return int64_t(b.x - a.x) * (y - a.y) - int64_t(b.y - a.y) * (x - a.x);
+}
+
+/*
+ * Draws a fan of triangles around a center point one triangle at a time, and counts how many
+ * triangles drew each pixel. Pixels strictly inside the fan's outline must be drawn exactly
+ * once, pixels strictly outside it never. Pixels exactly on the outline may go either way.
+ *
+ * @param outline - the corners of a convex outline, in counter-clockwise order
+ */
+static void CheckSharedEdges(GraphicsManager& graphics, const char* test, SubPixelPoint center,
+	const std::vector<SubPixelPoint>& outline)
+{
+	const int count = outline.size();
+	const Color color = {255, 255, 255};
+	const uint32_t packed = FrameBuffer::PackColor(color);
+
+	std::vector<int> drawn(canvas_size * canvas_size, 0);
+	for (int i = 0; i < count; ++i)
+	{
+		graphics.ChangeBrushColor(BLACK);
+		graphics.ClearScreen();
+		graphics.ClearDepthBuffer();
+		// Alternate the winding, since the rasterizer accepts both
+		if (i % 2 == 0)
+			graphics.DrawDepthTriangle(center, outline[i], outline[(i + 1) % count], color, 0.5f, 0.5f, 0.5f);
+		else
+			graphics.DrawDepthTriangle(outline[(i + 1) % count], outline[i], center, color, 0.5f, 0.5f, 0.5f);
+		graphics.RefreshScreen();
+
+		const FrameBuffer* frame_buffer = graphics.GetFrameBuffer();
+		for (int row = 0; row < canvas_size; ++row)
+		{
+			const uint32_t* pixels = frame_buffer->GetLinearRow(row);
+			for (int column = 0; column < canvas_size; ++column)
+			{
+				drawn[row * canvas_size + column] += (pixels[column] == packed);
+			}
+		}
+	}
+
+	for (int row = 0; row < canvas_size; ++row)
+	{
+		for (int column = 0; column < canvas_size; ++column)
+		{
+			// Pixels are sampled at their integer screen coordinates (0, 0 is the center, y is up)
+			int64_t x = int64_t(column - canvas_size / 2) * SUBPIXEL_SCALE;
+			int64_t y = int64_t(canvas_size / 2 - row) * SUBPIXEL_SCALE;
+			bool inside = true;
+			bool outside = false;
+			for (int i = 0; i < count; ++i)
+			{
+				int64_t side = Side(outline[i], outline[(i + 1) % count], x, y);
+				inside = inside && side > 0;
+				outside = outside || side < 0;
+			}
+
+			int times = drawn[row * canvas_size + column];
+			if (times > 1)
+				Fail(test, "drawn by more than one triangle", column, row);
+			else if (inside && times == 0)
+				Fail(test, "inside the fan but never drawn", column, row);
+			else if (outside && times != 0)
+				Fail(test, "outside the fan but drawn", column, row);
+		}
+	}
+}
+
+/*
+ * Draws a pile of overlapping triangles at different depths, and returns the image.
+ * The triangles are made up from a fixed seed, so every call draws the same ones.
+ */
+static std::vector<uint32_t> DrawPile(GraphicsManager& graphics)
+{
+	uint32_t seed = 12345;
+	auto next = [&seed](int range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return int((seed >> 8) % uint32_t(range));
+	};
+
+	graphics.ChangeBrushColor(BLACK);
+	graphics.ClearScreen();
+	graphics.ClearDepthBuffer();
+	const int reach = (canvas_size / 2 + 40) * SUBPIXEL_SCALE;	// Some triangles hang off the screen
+	for (int i = 0; i < 300; ++i)
+	{
+		SubPixelPoint p0 = {next(2 * reach) - reach, next(2 * reach) - reach};
+		SubPixelPoint p1 = {next(2 * reach) - reach, next(2 * reach) - reach};
+		SubPixelPoint p2 = {next(2 * reach) - reach, next(2 * reach) - reach};
+		Color color = {next(256), next(256), next(256)};
+		// 1/z values between 0.05 and 0.95
+		graphics.DrawDepthTriangle(p0, p1, p2, color,
+			0.05f + next(900) / 1000.0f, 0.05f + next(900) / 1000.0f, 0.05f + next(900) / 1000.0f);
+	}
+	graphics.RefreshScreen();
+
+	const FrameBuffer* frame_buffer = graphics.GetFrameBuffer();
+	std::vector<uint32_t> image(canvas_size * canvas_size);
+	for (int row = 0; row < canvas_size; ++row)
+	{
+		const uint32_t* pixels = frame_buffer->GetLinearRow(row);
+		std::copy(pixels, pixels + canvas_size, image.begin() + row * canvas_size);
+	}
+	return image;
+}
+
+/*
+ * Draws the same pile of triangles with and without the SIMD kernels, and compares the images.
+ */
+static void CheckKernelsMatch(GraphicsManager& graphics, const char* test)
+{
+	graphics.SetSimdRasterization(true);
+	std::vector<uint32_t> simd_image = DrawPile(graphics);
+	graphics.SetSimdRasterization(false);
+	std::vector<uint32_t> pixel_image = DrawPile(graphics);
+	graphics.SetSimdRasterization(true);
+
+	int background = 0;
+	for (int i = 0; i < canvas_size * canvas_size; ++i)
+	{
+		background += (pixel_image[i] == FrameBuffer::PackColor(BLACK));
+		if (simd_image[i] != pixel_image[i])
+		{
+			Fail(test, "the SIMD kernel drew a different color", i % canvas_size, i / canvas_size);
+			return;		// One report is enough to see that the kernels disagree
+		}
+	}
+	if (background == canvas_size * canvas_size)
+	{
+		Fail(test, "nothing was drawn", 0, 0);
+	}
+}
+
+int main()
+{
+	const DepthFormat formats[] = {DepthFormat::FLOAT32, DepthFormat::UNORM24, DepthFormat::UNORM16};
+	const char* format_names[] = {"FLOAT32", "UNORM24", "UNORM16"};
+	char test[64];
+
+	for (int f = 0; f < 3; ++f)
+	{
+		GraphicsManager graphics;
+		graphics.SetDepthFormat(formats[f]);
+		graphics.OpenOffscreen(canvas_size, canvas_size);
+
+		for (int simd = 1; simd >= 0; --simd)
+		{
+			graphics.SetSimdRasterization(simd == 1);
+			// Corners on whole pixels, so pixels land exactly on the shared edges (including
+			// horizontal, vertical, and diagonal ones) and the fill rule has to break the ties
+			std::snprintf(test, sizeof(test), "shared edges on pixels (%s%s)", format_names[f], simd ? "" : ", no SIMD");
+			CheckSharedEdges(graphics, test, {32, -16}, {{1472, -16}, {992, 944}, {32, 1424}, {-688, 1424},
+				{-1408, 464}, {-1408, -16}, {-928, -976}, {32, -1456}, {512, -1456}, {1472, -736}});
+			// Corners at uneven angles and sub-pixel positions
+			std::snprintf(test, sizeof(test), "shared edges off pixels (%s%s)", format_names[f], simd ? "" : ", no SIMD");
+			CheckSharedEdges(graphics, test, {37, -21}, {{1517, 83}, {1290, 771}, {903, 1366}, {150, 1601},
+				{-467, 1453}, {-1104, 1109}, {-1571, 390}, {-1449, -507}, {-1017, -1226}, {-299, -1643},
+				{488, -1529}, {1077, -1187}, {1482, -641}});
+		}
+
+		std::snprintf(test, sizeof(test), "SIMD kernel matches pixel kernel (%s)", format_names[f]);
+		CheckKernelsMatch(graphics, test);
+
+		graphics.CloseWindow();
+	}
+
+	if (failures > 0)
+	{
+		std::printf("rasterizer_test: %d checks failed\n", failures);
+		return 1;
+	}
+	std::printf("rasterizer_test: all checks passed\n");
+	return 0;
+}